@@ -0,0 +1,411 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Micro-benchmarks for the code that converts data into Gnuplot commands
+ *
+ * Usage: gplotpp_bench [--max-size N] [--perf] [--json FILE] [FILTER]
+ *
+ * Everything is sent to a GnuplotNullBackend, so Gnuplot is not needed.
+ * Each benchmark runs with sizes 1e3, 1e4, ... up to --max-size
+ * (default: 1e6; the 6-column plots need ~50 bytes of memory per point,
+ * so be careful above 1e7). If FILTER is given, only the benchmarks
+ * whose name contains it are run. With --perf, hardware counters are
+ * read through perf_event_open (Linux only).
+ */
+
+#include "gplot++.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Count the allocations made by the whole program
+
+static std::atomic<size_t> num_of_allocations{};
+
+void *operator new(size_t size) {
+  num_of_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size))
+    return ptr;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+////////////////////////////////////////////////////////////////////////
+// Hardware counters
+
+struct Counter {
+  const char *name;
+  uint64_t value;
+};
+
+#ifdef __linux__
+class PerfCounters {
+public:
+  PerfCounters() {
+    const std::pair<const char *, uint64_t> events[] = {
+        {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+        {"cache_misses", PERF_COUNT_HW_CACHE_MISSES},
+        {"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    for (const auto &event : events) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = event.second;
+      attr.disabled = fds.empty() ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+
+      int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1,
+                                        fds.empty() ? -1 : fds[0], 0));
+      if (fd < 0) {
+        // The first one is the group leader: without it, nothing works
+        if (fds.empty())
+          return;
+        continue;
+      }
+
+      fds.push_back(fd);
+      names.push_back(event.first);
+    }
+  }
+
+  ~PerfCounters() {
+    for (int fd : fds)
+      close(fd);
+  }
+
+  [[nodiscard]] bool ok() const { return !fds.empty(); }
+
+  void start() {
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  std::vector<Counter> stop() {
+    ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    std::vector<uint64_t> values(fds.size() + 1);
+    std::vector<Counter> result{};
+    const auto size = static_cast<ssize_t>(values.size() * sizeof(uint64_t));
+    if (read(fds[0], values.data(), values.size() * sizeof(uint64_t)) != size)
+      return result;
+
+    for (size_t i{}; i < names.size(); ++i)
+      result.push_back(Counter{names[i], values[i + 1]});
+    return result;
+  }
+
+private:
+  std::vector<int> fds{};
+  std::vector<const char *> names{};
+};
+#else
+class PerfCounters {
+public:
+  [[nodiscard]] bool ok() const { return false; }
+  void start() {}
+  std::vector<Counter> stop() { return {}; }
+};
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Benchmarks
+
+/* Each benchmark prepares its input outside the timed region, then
+ * calls `measure` exactly once around the code to time. It returns
+ * the number of bytes produced, which is used to compute MB/s */
+using Measure = std::function<void(const std::function<void()> &)>;
+
+struct Benchmark {
+  std::string name;
+  size_t max_size;
+  std::function<size_t(size_t, const Measure &)> run;
+};
+
+static std::vector<double> make_data(size_t n, double phase) {
+  std::vector<double> result(n);
+  for (size_t i{}; i < n; ++i)
+    result[i] = std::sin(0.001 * static_cast<double>(i) + phase);
+  return result;
+}
+
+// Time one of the `plot*` methods, which serialize the data
+template <typename PlotFunction>
+static size_t bench_plot(size_t n, const Measure &measure, int columns,
+                         PlotFunction plot) {
+  std::vector<std::vector<double>> columns_data;
+  for (int i{}; i < columns; ++i)
+    columns_data.push_back(make_data(n, i));
+
+  auto backend = std::make_unique<GnuplotNullBackend>();
+  GnuplotNullBackend &null = *backend;
+  Gnuplot plt{std::move(backend)};
+
+  measure([&]() { plot(plt, columns_data); });
+
+  null.reset();
+  plt.show();
+  return null.bytes(GnuplotBackend::Channel::DATA);
+}
+
+using Columns = std::vector<std::vector<double>>;
+
+static std::vector<Benchmark> all_benchmarks() {
+  const size_t unlimited{static_cast<size_t>(-1)};
+
+  return {
+      {"plot_1col", unlimited,
+       [](size_t n, const Measure &m) {
+         return bench_plot(n, m, 1, [](Gnuplot &plt, const Columns &c) {
+           plt.plot(c[0]);
+         });
+       }},
+      {"plot_2col", unlimited,
+       [](size_t n, const Measure &m) {
+         return bench_plot(n, m, 2, [](Gnuplot &plt, const Columns &c) {
+           plt.plot(c[0], c[1]);
+         });
+       }},
+      {"plot_3col", unlimited,
+       [](size_t n, const Measure &m) {
+         return bench_plot(n, m, 3, [](Gnuplot &plt, const Columns &c) {
+           plt.plot_yerr(c[0], c[1], c[2]);
+         });
+       }},
+      {"plot_4col", unlimited,
+       [](size_t n, const Measure &m) {
+         return bench_plot(n, m, 4, [](Gnuplot &plt, const Columns &c) {
+           plt.plot_vectors(c[0], c[1], c[2], c[3]);
+         });
+       }},
+      {"plot_6col", unlimited,
+       [](size_t n, const Measure &m) {
+         return bench_plot(n, m, 6, [](Gnuplot &plt, const Columns &c) {
+           plt.plot_vectors3d(c[0], c[1], c[2], c[3], c[4], c[5]);
+         });
+       }},
+      {"histogram", unlimited,
+       [](size_t n, const Measure &m) {
+         auto values = make_data(n, 0.0);
+         auto backend = std::make_unique<GnuplotNullBackend>();
+         GnuplotNullBackend &null = *backend;
+         Gnuplot plt{std::move(backend)};
+
+         m([&]() { plt.histogram(values, 100); });
+
+         null.reset();
+         plt.show();
+         return null.bytes(GnuplotBackend::Channel::DATA);
+       }},
+      {"show", unlimited,
+       [](size_t n, const Measure &m) {
+         auto x = make_data(n, 0.0), y = make_data(n, 1.0);
+         auto backend = std::make_unique<GnuplotNullBackend>();
+         GnuplotNullBackend &null = *backend;
+         Gnuplot plt{std::move(backend)};
+
+         plt.plot(x, y, "First");
+         plt.plot(y, x, "Second");
+         null.reset();
+         m([&]() { plt.show(); });
+         return null.total_bytes();
+       }},
+      {"escape_quotes", unlimited,
+       [](size_t n, const Measure &m) {
+         // One quote every 8 characters
+         std::string title(n, 'a');
+         for (size_t i{}; i < n; i += 8)
+           title[i] = '\'';
+
+         auto backend = std::make_unique<GnuplotNullBackend>();
+         GnuplotNullBackend &null = *backend;
+         Gnuplot plt{std::move(backend)};
+
+         null.reset();
+         m([&]() { plt.set_title(title); });
+         return null.total_bytes();
+       }},
+      // Here `n` is the number of plots, each needing three ranges
+      {"format_range", 100000,
+       [](size_t n, const Measure &m) {
+         const std::vector<double> point{1.0};
+         auto backend = std::make_unique<GnuplotNullBackend>();
+         GnuplotNullBackend &null = *backend;
+         Gnuplot plt{std::move(backend)};
+
+         null.reset();
+         m([&]() {
+           for (size_t i{}; i < n; ++i) {
+             const double value = static_cast<double>(i);
+             plt.set_xrange(-value, value);
+             plt.set_yrange(-value, NAN);
+             plt.set_zrange(NAN, value);
+             plt.plot3d(point, point, point);
+             plt.show();
+           }
+         });
+         return null.total_bytes();
+       }},
+  };
+}
+
+struct Result {
+  std::string name;
+  size_t size;
+  double seconds;
+  size_t bytes;
+  size_t allocations;
+  std::vector<Counter> counters;
+};
+
+static void write_json(std::ostream &os, const std::vector<Result> &results) {
+  os << "{\n  \"version\": \"" << GNUPLOTPP_MAJOR_VERSION << '.'
+     << GNUPLOTPP_MINOR_VERSION << '.' << GNUPLOTPP_PATCH_VERSION
+     << "\",\n  \"results\": [";
+
+  for (size_t i{}; i < results.size(); ++i) {
+    const Result &r = results[i];
+    const auto n = static_cast<double>(r.size);
+    os << (i > 0 ? "," : "") << "\n    {\"name\": \"" << r.name
+       << "\", \"size\": " << r.size << ", \"seconds\": " << r.seconds
+       << ", \"bytes\": " << r.bytes
+       << ", \"points_per_second\": " << n / r.seconds
+       << ", \"mb_per_second\": " << r.bytes / r.seconds / 1e6
+       << ", \"allocations_per_point\": " << r.allocations / n;
+
+    if (!r.counters.empty()) {
+      os << ", \"counters\": {";
+      for (size_t j{}; j < r.counters.size(); ++j)
+        os << (j > 0 ? ", " : "") << '"' << r.counters[j].name
+           << "\": " << r.counters[j].value;
+      os << '}';
+    }
+    os << '}';
+  }
+
+  os << "\n  ]\n}\n";
+}
+
+static void print_usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--max-size N] [--perf] [--json FILE] [FILTER]\n";
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_size{1000000};
+  bool use_perf{false};
+  std::string json_file{}, filter{};
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+      max_size = static_cast<size_t>(std::atof(argv[++i]));
+    } else if (std::strcmp(argv[i], "--perf") == 0) {
+      use_perf = true;
+    } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_file = argv[++i];
+    } else if (argv[i][0] != '-' && filter.empty()) {
+      filter = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  PerfCounters perf{};
+  if (use_perf && !perf.ok()) {
+    std::cerr << "Warning, hardware counters are not available\n";
+    use_perf = false;
+  }
+
+  std::vector<Result> results{};
+  std::cout << std::left << std::setw(16) << "Benchmark" << std::right
+            << std::setw(12) << "Size" << std::setw(14) << "Points/s"
+            << std::setw(10) << "MB/s" << std::setw(12) << "Allocs/pt"
+            << '\n';
+
+  for (const auto &benchmark : all_benchmarks()) {
+    if (benchmark.name.find(filter) == std::string::npos)
+      continue;
+
+    for (size_t n{1000}; n <= max_size && n <= benchmark.max_size; n *= 10) {
+      Result result{benchmark.name, n, 0.0, 0, 0, {}};
+
+      result.bytes = benchmark.run(n, [&](const std::function<void()> &f) {
+        const size_t allocations_before = num_of_allocations.load();
+        if (use_perf)
+          perf.start();
+        const auto start = std::chrono::steady_clock::now();
+
+        f();
+
+        const auto end = std::chrono::steady_clock::now();
+        if (use_perf)
+          result.counters = perf.stop();
+        result.allocations = num_of_allocations.load() - allocations_before;
+        result.seconds = std::chrono::duration<double>(end - start).count();
+      });
+
+      const auto points = static_cast<double>(n);
+      std::cout << std::left << std::setw(16) << result.name << std::right
+                << std::setw(12) << n << std::setw(14) << std::setprecision(4)
+                << points / result.seconds << std::setw(10)
+                << result.bytes / result.seconds / 1e6 << std::setw(12)
+                << result.allocations / points << '\n';
+      results.push_back(result);
+    }
+  }
+
+  if (!json_file.empty()) {
+    std::ofstream out{json_file};
+    write_json(out, results);
+    if (!out) {
+      std::cerr << "Error, unable to write \"" << json_file << "\"\n";
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,286 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* End-to-end benchmark measuring how long Gnuplot takes to render plots
+ *
+ * Usage: gplotpp_render_bench [--max-size N] [--repeat N] [--exe GNUPLOT]
+ *                             [--json FILE] [FILTER]
+ *
+ * For each terminal, line style, and number of points (100, 1000, ...
+ * up to --max-size, default 1e5), it measures three phases:
+ *
+ * - upload: the datablock is sent and parsed by Gnuplot;
+ * - render: the `plot` command is executed;
+ * - finalize: `unset output` writes the file and closes it.
+ *
+ * Each phase ends with Gnuplot::sync(), so no time is wasted sleeping.
+ * If --repeat is larger than 1, the fastest run is reported. If FILTER
+ * is given, only the cases whose name ("png/lines", "svg/boxes", ...)
+ * contains it are run. Gnuplot::sync() is not available on Windows.
+ */
+
+#include "gplot++.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using LineStyle = Gnuplot::LineStyle;
+using clock_type = std::chrono::steady_clock;
+
+struct Terminal {
+  std::string name;
+  std::string extension;
+  std::function<bool(Gnuplot &, const std::string &)> redirect;
+};
+
+struct Style {
+  std::string name;
+  LineStyle style;
+};
+
+struct Timing {
+  double upload{INFINITY};
+  double render{INFINITY};
+  double finalize{INFINITY};
+  size_t bytes{};
+};
+
+static const std::vector<Terminal> terminals{
+    {"png", ".png",
+     [](Gnuplot &plt, const std::string &f) {
+       return plt.redirect_to_png(f);
+     }},
+    {"svg", ".svg",
+     [](Gnuplot &plt, const std::string &f) {
+       return plt.redirect_to_svg(f);
+     }},
+    {"pdf", ".pdf",
+     [](Gnuplot &plt, const std::string &f) {
+       return plt.redirect_to_pdf(f);
+     }},
+    {"gif", ".gif",
+     [](Gnuplot &plt, const std::string &f) {
+       return plt.redirect_to_animated_gif(f);
+     }},
+    {"dumb", ".txt",
+     [](Gnuplot &plt, const std::string &f) {
+       return plt.redirect_to_dumb(f);
+     }},
+};
+
+static const std::vector<Style> styles{
+    {"dots", LineStyle::DOTS},
+    {"lines", LineStyle::LINES},
+    {"points", LineStyle::POINTS},
+    {"linespoints", LineStyle::LINESPOINTS},
+    {"steps", LineStyle::STEPS},
+    {"boxes", LineStyle::BOXES},
+    {"xerrorbars", LineStyle::X_ERROR_BARS},
+    {"yerrorbars", LineStyle::Y_ERROR_BARS},
+    {"xyerrorbars", LineStyle::XY_ERROR_BARS},
+    {"vectors", LineStyle::VECTORS},
+};
+
+// Call the `plot*` method that matches `style`
+static void plot_with_style(Gnuplot &plt, LineStyle style, size_t n) {
+  std::vector<double> x(n), y(n), dx(n), dy(n);
+  for (size_t i{}; i < n; ++i) {
+    x[i] = static_cast<double>(i);
+    y[i] = std::sin(0.01 * x[i]);
+    dx[i] = 0.1;
+    dy[i] = 0.05 * std::cos(0.01 * x[i]);
+  }
+
+  switch (style) {
+  case LineStyle::X_ERROR_BARS:
+    plt.plot_xerr(x, y, dx);
+    break;
+  case LineStyle::Y_ERROR_BARS:
+    plt.plot_yerr(x, y, dy);
+    break;
+  case LineStyle::XY_ERROR_BARS:
+    plt.plot_xyerr(x, y, dx, dy);
+    break;
+  case LineStyle::VECTORS:
+    plt.plot_vectors(x, y, dx, dy);
+    break;
+  default:
+    plt.plot(x, y, "", style);
+  }
+}
+
+static double seconds_since(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+/* Run one case. The commands are first produced by a `Gnuplot` object
+ * writing into a GnuplotRecordingBackend, so that data and commands can
+ * be sent (and timed) separately */
+static bool run_case(const std::string &exe, const Terminal &terminal,
+                     LineStyle style, size_t n, Timing &timing) {
+  std::string data{}, commands{};
+  {
+    auto backend = std::make_unique<GnuplotRecordingBackend>();
+    GnuplotRecordingBackend &recording = *backend;
+    Gnuplot scratch{std::move(backend)};
+
+    recording.clear();
+    plot_with_style(scratch, style, n);
+    scratch.show();
+    data = recording.str(GnuplotBackend::Channel::DATA);
+    commands = recording.str(GnuplotBackend::Channel::COMMAND);
+  }
+
+  Gnuplot plt{exe.c_str(), false};
+  const std::string output{"gplotpp_render_bench" + terminal.extension};
+  if (!terminal.redirect(plt, output) || !plt.sync())
+    return false;
+
+  GnuplotBackend &backend = *plt.get_backend();
+
+  auto start = clock_type::now();
+  if (!backend.write(GnuplotBackend::Channel::DATA, data.data(),
+                     data.size()) ||
+      !backend.flush() || !plt.sync())
+    return false;
+  timing.upload = std::min(timing.upload, seconds_since(start));
+
+  start = clock_type::now();
+  if (!backend.write(GnuplotBackend::Channel::COMMAND, commands.data(),
+                     commands.size()) ||
+      !backend.flush() || !plt.sync())
+    return false;
+  timing.render = std::min(timing.render, seconds_since(start));
+
+  start = clock_type::now();
+  if (!plt.sendcommand("unset output") || !plt.sync())
+    return false;
+  timing.finalize = std::min(timing.finalize, seconds_since(start));
+
+  timing.bytes = data.size() + commands.size();
+  std::remove(output.c_str());
+  return true;
+}
+
+static void print_usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--max-size N] [--repeat N] [--exe GNUPLOT] [--json FILE] "
+               "[FILTER]\n";
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_size{100000};
+  int repeat{1};
+  std::string exe{"gnuplot"}, json_file{}, filter{};
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+      max_size = static_cast<size_t>(std::atof(argv[++i]));
+    } else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--exe") == 0 && i + 1 < argc) {
+      exe = argv[++i];
+    } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_file = argv[++i];
+    } else if (argv[i][0] != '-' && filter.empty()) {
+      filter = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  {
+    Gnuplot probe{exe.c_str(), false};
+    if (!probe.sync(10000)) {
+      std::cerr << "Error, unable to synchronize with \"" << exe
+                << "\" (this is not supported on Windows)\n";
+      return 1;
+    }
+  }
+
+  std::stringstream json;
+  json << "{\n  \"version\": \"" << GNUPLOTPP_MAJOR_VERSION << '.'
+       << GNUPLOTPP_MINOR_VERSION << '.' << GNUPLOTPP_PATCH_VERSION
+       << "\",\n  \"results\": [";
+  bool first_result{true};
+
+  std::cout << std::left << std::setw(20) << "Case" << std::right
+            << std::setw(10) << "Points" << std::setw(12) << "Upload [s]"
+            << std::setw(12) << "Render [s]" << std::setw(14)
+            << "Finalize [s]" << '\n'
+            << std::setprecision(4);
+
+  for (const auto &terminal : terminals) {
+    for (const auto &style : styles) {
+      const std::string name{terminal.name + "/" + style.name};
+      if (name.find(filter) == std::string::npos)
+        continue;
+
+      for (size_t n{100}; n <= max_size; n *= 10) {
+        Timing timing{};
+        for (int i{}; i < repeat; ++i) {
+          if (!run_case(exe, terminal, style.style, n, timing)) {
+            std::cerr << "Error, case " << name << " with " << n
+                      << " points failed\n";
+            return 1;
+          }
+        }
+
+        std::cout << std::left << std::setw(20) << name << std::right
+                  << std::setw(10) << n << std::setw(12) << timing.upload
+                  << std::setw(12) << timing.render << std::setw(14)
+                  << timing.finalize << std::endl;
+
+        json << (first_result ? "" : ",") << "\n    {\"terminal\": \""
+             << terminal.name << "\", \"style\": \"" << style.name
+             << "\", \"points\": " << n << ", \"bytes\": " << timing.bytes
+             << ", \"upload_seconds\": " << timing.upload
+             << ", \"render_seconds\": " << timing.render
+             << ", \"finalize_seconds\": " << timing.finalize << '}';
+        first_result = false;
+      }
+    }
+  }
+
+  json << "\n  ]\n}\n";
+
+  if (!json_file.empty()) {
+    std::ofstream out{json_file};
+    out << json.str();
+    if (!out) {
+      std::cerr << "Error, unable to write \"" << json_file << "\"\n";
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gplot++.h"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+int main(void) {
+  GnuplotBatch batch{};
+
+  std::cout << "Rendering plots using " << batch.num_of_workers()
+            << " Gnuplot processes\n";
+
+  for (int i{}; i < 20; ++i) {
+    std::string file_name{"batch-" + std::to_string(i) + ".png"};
+
+    batch.submit(
+        file_name,
+        [i](Gnuplot &plt) {
+          std::vector<double> x, y;
+          for (int k{}; k < 100; ++k) {
+            x.push_back(k * 0.1);
+            y.push_back(std::sin(k * 0.1 * (i + 1)));
+          }
+
+          plt.set_title("Frequency " + std::to_string(i + 1));
+          plt.plot(x, y);
+        },
+        0, [](const std::string &output, bool success) {
+          std::cout << output << (success ? " done\n" : " failed\n");
+        });
+  }
+
+  batch.wait();
+}
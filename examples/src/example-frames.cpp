@@ -0,0 +1,53 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "gplot++.h"
+#include <cmath>
+#include <iostream>
+
+int main(void) {
+  Gnuplot gnuplot{};
+  const int num_of_frames = 100;
+
+  gnuplot.redirect_to_animated_gif("frames.gif", "800,600", 50, true);
+
+  for (int i{}; i < num_of_frames; ++i) {
+    std::vector<double> x, y;
+    for (int k{}; k < 200; ++k) {
+      x.push_back(k * 0.05);
+      y.push_back(std::sin(k * 0.05 - i * 0.1));
+    }
+
+    gnuplot.plot(x, y, "sin(x - t)");
+    gnuplot.set_xrange(0, 10);
+    gnuplot.set_yrange(-1.1, 1.1);
+
+    // Keep the frame in memory instead of calling `show()`
+    gnuplot.next_frame();
+  }
+
+  // Send all the frames to Gnuplot at once
+  gnuplot.show_frames();
+
+  std::cout << "Animation saved in frames.gif\n";
+}
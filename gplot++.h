@@ -64,18 +64,59 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #ifdef _WIN32
+// Otherwise <Windows.h> defines `min` and `max` as macros, which break
+// `std::min`, `std::max`, and `std::numeric_limits<T>::max`
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #else
+#include <cerrno>
+#include <csignal>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
+
+extern char **environ;
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
 #endif
 
 const unsigned GNUPLOTPP_VERSION = 0x000a01;
@@ -84,297 +125,3452 @@ const unsigned GNUPLOTPP_MINOR_VERSION = (GNUPLOTPP_VERSION & 0x00FF00) >> 8;
 const unsigned GNUPLOTPP_PATCH_VERSION = (GNUPLOTPP_VERSION & 0xFF);
 
 /**
- * High-level interface to the Gnuplot executable
+ * Transport used by `Gnuplot` to talk with a Gnuplot process
  *
- * This class establishes a connection with a new Gnuplot instance and
- * sends commands to it through a pipe. It is able to directly plot
- * vectors of numbers by saving them in temporary files.
+ * `Gnuplot` never writes to a pipe directly: all the commands and
+ * data go through a backend. Commands (e.g., `plot`) and data (the
+ * datablocks) are sent through two separate channels, although all
+ * the backends provided here send them to the same stream.
+ *
+ * Derived classes must implement at least `write` and `ok`.
  */
-class Gnuplot {
-private:
-  static FILE *safe_popen(const char *name, const char *mode) {
-#ifdef _WIN32
-    return _popen(name, mode);
-#else
-    return popen(name, mode);
-#endif
-  }
+class GnuplotBackend {
+public:
+  enum class Channel {
+    COMMAND,
+    DATA,
+  };
 
-  static int safe_pclose(FILE *f) {
-#ifdef _WIN32
-    return _pclose(f);
-#else
-    return pclose(f);
-#endif
-  }
+  GnuplotBackend() = default;
+  GnuplotBackend(const GnuplotBackend &) = delete;
+  GnuplotBackend &operator=(const GnuplotBackend &) = delete;
+  virtual ~GnuplotBackend() = default;
 
-  static void safe_sleep(unsigned seconds) {
-#ifdef _WIN32
-    Sleep(seconds * 1000); // Sleep on Windows requires milliseconds
-#else
-    sleep(seconds);
-#endif
-  }
+  /* Send `size` bytes through `channel`. Commands and data are
+   * already terminated by newlines. Return `false` on error. */
+  virtual bool write(Channel channel, const char *buf, size_t size) = 0;
 
-  std::string escape_quotes(const std::string &s) {
-    std::string result{};
+  /* Make sure that everything written so far has been delivered */
+  virtual bool flush() { return true; }
 
-    for (char c : s) {
-      if (c != '\'')
-        result.push_back(c);
-      else
-        result += "''";
-    }
+  /* Return `true` if the backend is still able to accept data */
+  [[nodiscard]] virtual bool ok() const = 0;
 
-    return result;
+  /* Wait until Gnuplot has executed all the commands written so far
+   * (see `Gnuplot::sync()`). If `output` is not null, append to it
+   * anything Gnuplot writes into `output_file()` in the meantime.
+   * Return `false` on timeout, on error, or if this is not supported.
+   * Implementations might use `set print`, thus resetting the target
+   * of Gnuplot's `print` command to the standard error. */
+  virtual bool sync(int timeout_ms, std::string *output) {
+    (void)timeout_ms;
+    (void)output;
+    return false;
   }
 
-  std::vector<double> list_of_x;
-  std::vector<double> list_of_y;
-  std::vector<double> list_of_xerr;
-  std::vector<double> list_of_yerr;
+  /* Name of a file that Gnuplot can use in `set output` to send data
+   * back to us (see `sync`), or an empty string if not supported */
+  [[nodiscard]] virtual std::string output_file() const { return {}; }
 
-  void check_consistency() const {
-    assert(list_of_x.size() == list_of_y.size());
+  /* Close the connection and wait until Gnuplot has completed its
+   * work. Nothing can be written after this. */
+  virtual void close() {}
 
-    if (list_of_xerr.size() > 0)
-      assert(list_of_xerr.size() == list_of_x.size());
-    if (list_of_yerr.size() > 0)
-      assert(list_of_yerr.size() == list_of_y.size());
+  /* Called with the number passed to `request_ack` as soon as Gnuplot
+   * has executed all the commands sent before it */
+  using AckHandler = std::function<void(uint64_t)>;
+
+  /* Set the function called when acknowledgements arrive (null to
+   * remove it). Return `false` if this is not supported. The handler
+   * might be called from another thread. */
+  virtual bool set_ack_handler(AckHandler handler) {
+    (void)handler;
+    return false;
   }
 
-public:
-  enum class LineStyle {
-    DOTS,
-    LINES,
-    POINTS,
-    LINESPOINTS,
-    STEPS,
-    BOXES,
-    X_ERROR_BARS,
-    Y_ERROR_BARS,
-    XY_ERROR_BARS,
-    VECTORS,
-  };
+  /* Ask Gnuplot to acknowledge that it has reached this point, without
+   * waiting for it. See `set_ack_handler` */
+  virtual bool request_ack(uint64_t seq) {
+    (void)seq;
+    return false;
+  }
 
-  enum class AxisScale {
-    LINEAR,
-    LOGX,
-    LOGY,
-    LOGXY,
-  };
+  /* Return the PID of the Gnuplot process, or -1 if unknown */
+  [[nodiscard]] virtual int pid() const { return -1; }
 
-  enum class TerminalMode {
-    MONO,
-    ANSI,
-    ANSI256,
-    ANSIRGB,
-  };
+  /* Send a command followed by a newline, and flush it */
+  bool write_command(const std::string &command) {
+    return write(Channel::COMMAND, command.data(), command.size()) &&
+           write(Channel::COMMAND, "\n", 1) && flush();
+  }
 
-  Gnuplot(const char *executable_name = "gnuplot", bool persist = true)
-      : connection{}, series{}, files_to_delete{}, is_3dplot{false} {
+protected:
+  // Build a sentinel that has not been used by this backend yet
+  std::string next_sentinel() {
     std::stringstream os;
-    // The --persist flag lets Gnuplot keep running after the C++
-    // program has completed its execution
-    os << executable_name;
-    if (persist)
-      os << " --persist";
-    connection = safe_popen(os.str().c_str(), "w");
+    os << "GPLOTPP_SYNC " << ++sync_counter;
+    return os.str();
+  }
 
-    set_xrange();
-    set_yrange();
-    set_zrange();
+  // Prefix of the lines used to acknowledge `request_ack`
+  static constexpr const char *ACK_PREFIX = "GPLOTPP_ACK ";
 
-    // See
-    // https://stackoverflow.com/questions/28152719/how-to-make-gnuplot-use-the-unicode-minus-sign-for-negative-numbers
-    sendcommand("set encoding utf8\n");
-    sendcommand("set minussign");
+  // Commands that make Gnuplot print `sentinel` into `file`. Gnuplot
+  // does not tell where `print` was writing, so it cannot be restored
+  // afterwards: it goes back to the standard error
+  static std::string print_sentinel(const std::string &file,
+                                    const std::string &sentinel) {
+    return "set print '" + file + "'\nprint '" + sentinel + "'\nset print";
   }
 
-  ~Gnuplot() {
-    // Bye bye, Gnuplot!
-    if (connection) {
-      safe_pclose(connection);
-      connection = nullptr;
-    }
+#ifndef _WIN32
+public:
+  /* Block SIGPIPE in the calling thread during its lifetime, so that
+   * writing to a Gnuplot process that has quit fails with EPIPE
+   * instead of killing the program. A SIGPIPE raised meanwhile is
+   * discarded, unless one was already pending. Guards can be nested:
+   * only the outermost one makes system calls, so it pays to create
+   * one around a sequence of writes */
+  class SigpipeGuard {
+  public:
+    SigpipeGuard() {
+      if (nesting()++ > 0)
+        return;
 
-    // Let some time pass before removing the files, so that Gnuplot
-    // can finish displaying the last plot.
-    safe_sleep(1);
+      sigemptyset(&sigpipe);
+      sigaddset(&sigpipe, SIGPIPE);
 
-    // Now remove the data files
-    for (const auto &fname : files_to_delete) {
-      std::remove(fname.c_str());
+      sigset_t pending;
+      sigpending(&pending);
+      was_pending = sigismember(&pending, SIGPIPE) == 1;
+      pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
     }
-  }
 
-  /* This is the most low-level method in the Gnuplot class! It
-         returns `true` if the send command was successful, `false`
-         otherwise. */
-  bool sendcommand(const char *str) {
-    if (!ok())
-      return false;
+    ~SigpipeGuard() {
+      if (--nesting() > 0)
+        return;
 
-    fputs(str, connection);
-    fputc('\n', connection);
-    fflush(connection);
+      if (!was_pending) {
+        sigset_t pending;
+        sigpending(&pending);
+        int sig;
+        if (sigismember(&pending, SIGPIPE) == 1)
+          sigwait(&sigpipe, &sig);
+      }
+      pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
 
-    return true;
-  }
+    SigpipeGuard(const SigpipeGuard &) = delete;
+    SigpipeGuard &operator=(const SigpipeGuard &) = delete;
 
-  bool sendcommand(const std::string &str) { return sendcommand(str.c_str()); }
-  bool sendcommand(const std::stringstream &stream) {
-    return sendcommand(stream.str());
-  }
+  private:
+    // Number of guards alive in the calling thread
+    static int &nesting() {
+      static thread_local int count{};
+      return count;
+    }
 
-  [[nodiscard]] bool ok() { return connection != nullptr; }
+    sigset_t sigpipe{};
+    sigset_t old_mask{};
+    bool was_pending{};
+  };
 
-  /* Save the plot to a PNG file instead of displaying a window */
-  bool redirect_to_png(const std::string &filename,
-                       const std::string &size = "800,600") {
-    std::stringstream os;
+protected:
 
-    os << "set terminal pngcairo color enhanced size " << size << "\n"
-       << "set output '" << filename << "'\n";
-    return sendcommand(os);
-  }
+  // Read from `fd` until the line `expected` is found, waiting at
+  // most `timeout_ms` milliseconds (forever if negative). `buffer`
+  // keeps what has been read but not consumed yet. If `output` is not
+  // null, collect data from the non-blocking `output_fd` meanwhile
+  static bool wait_for_line(int fd, std::string &buffer,
+                            const std::string &expected, int timeout_ms,
+                            int output_fd = -1,
+                            std::string *output = nullptr) {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
 
-  /* Save the plot to a PDF file instead of displaying a window */
-  bool redirect_to_pdf(const std::string &filename,
-                       std::string size = "16cm,12cm") {
-    std::stringstream os;
+    while (true) {
+      size_t newline;
+      while ((newline = buffer.find('\n')) != std::string::npos) {
+        std::string line{buffer.substr(0, newline)};
+        buffer.erase(0, newline + 1);
 
-    os << "set terminal pdfcairo color enhanced size " << size << "\n"
-       << "set output '" << filename << "'\n";
-    return sendcommand(os);
-  }
+        // Lines that do not match are stale replies to earlier
+        // requests that timed out, or output printed by the user
+        if (line == expected) {
+          // Gnuplot wrote the output before the sentinel, so what
+          // is left in the pipe is already there
+          if (output)
+            read_available(output_fd, *output);
+          return true;
+        }
+      }
 
-  /* Save the plot to a SVG file instead of displaying a window */
-  bool redirect_to_svg(const std::string &filename,
-                       const std::string &size = "800,600") {
-    std::stringstream os;
+      int wait_ms = -1;
+      if (timeout_ms >= 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - clock::now());
+        if (left.count() <= 0)
+          return false;
+        wait_ms = static_cast<int>(left.count());
+      }
 
-    os << "set terminal svg enhanced mouse standalone size " << size << "\n"
-       << "set output '" << filename << "'\n";
-    return sendcommand(os);
-  }
+      pollfd pfd[2]{{fd, POLLIN, 0}, {output_fd, POLLIN, 0}};
+      int result = poll(pfd, output ? 2 : 1, wait_ms);
+      if (result < 0 && errno == EINTR)
+        continue;
+      if (result <= 0)
+        return false;
 
-  /* Save the plot to an animated GIF. The delay between frames is specified
-   * by the `delay_ms` parameter (in milliseconds). If `loop` is `true` (the
-   * default), the animation will loop indefinitely, otherwise it will just
-   * play once and stop at the last frame.
-   *
-   * Note that frames are saved only once you call `Gnuplot::show()`. Therefore,
-   * if you want to put N frames in your animation, you have to call
-   * `Gnuplot::show()` exactly N times.
-   */
-  bool redirect_to_animated_gif(const std::string &filename,
-                                const std::string &size = "800,600",
-                                int delay_ms = 50, bool loop = true) {
-    std::stringstream os;
+      // The output must be drained, otherwise Gnuplot could block
+      // before printing the sentinel
+      if (output && (pfd[1].revents & POLLIN))
+        read_available(output_fd, *output);
 
-    // Unfortunately, Gnuplot requires the delay to be expressed in units of
-    // 1/100 s instead of the more common unit 1/1000 s, so we need to divide
-    // by 10. We do not support a fixed number of repetitions: either you loop
-    // infinitely or play the animation just once
-    os << "set terminal gif animate delay " << delay_ms / 10 << " loop "
-	<< (loop ? 0 : 1) << " size " << size << "\n"
-       << "set output '" << filename << "'\n";
-    return sendcommand(os);
-  }
+      if (pfd[0].revents == 0)
+        continue;
 
-  /* Send the plot to the terminal or to a text file */
-  bool redirect_to_dumb(const std::string &filename = "",
-                        unsigned int width = 80, unsigned int height = 50,
-                        TerminalMode mode = TerminalMode::MONO) {
-    std::stringstream os;
+      char buf[256];
+      ssize_t count = read(fd, buf, sizeof(buf));
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false; // Gnuplot has quit
 
-    os << "set terminal dumb size " << width << " " << height;
+      buffer.append(buf, static_cast<size_t>(count));
+    }
+  }
 
-    switch (mode) {
-    case TerminalMode::MONO:
-      os << "mono";
-      break;
-    case TerminalMode::ANSI:
-      os << "ansi";
-      break;
-    case TerminalMode::ANSI256:
-      os << "ansi256";
-      break;
-    case TerminalMode::ANSIRGB:
-      os << "ansirgb";
-      break;
-    default:
-      os << "mono";
+  // Append to `output` whatever is available in the non-blocking `fd`
+  static void read_available(int fd, std::string &output) {
+    char buf[65536];
+    ssize_t count;
+    while ((count = read(fd, buf, sizeof(buf))) > 0 ||
+           (count < 0 && errno == EINTR)) {
+      if (count > 0)
+        output.append(buf, static_cast<size_t>(count));
     }
+  }
+#endif
 
-    os << "\n";
+private:
+  unsigned long sync_counter{};
+};
 
-    if (!filename.empty()) {
-      os << "set output '" << filename << "'\n";
-    }
+/**
+ * Backend running Gnuplot through `popen`
+ *
+ * This is the only way to start Gnuplot on Windows. It cannot read
+ * anything back from Gnuplot, so `sync` is not supported.
+ */
+class GnuplotPipeBackend : public GnuplotBackend {
+public:
+  explicit GnuplotPipeBackend(const std::string &command)
+      : connection{safe_popen(command.c_str(), "w")} {}
 
-    return sendcommand(os);
-  }
+  ~GnuplotPipeBackend() override { close(); }
 
-  bool set_title(const std::string &title) {
-    std::stringstream os;
-    os << "set title '" << escape_quotes(title) << "'";
-    return sendcommand(os);
-  }
+  bool write(Channel, const char *buf, size_t size) override {
+    if (!ok())
+      return false;
 
-  /* Set the label on the X axis */
-  bool set_xlabel(const std::string &label) {
-    std::stringstream os;
-    os << "set xlabel '" << escape_quotes(label) << "'";
-    return sendcommand(os);
+#ifndef _WIN32
+    SigpipeGuard guard{};
+#endif
+    broken = fwrite(buf, 1, size, connection) != size;
+    return !broken;
   }
 
-  /* Set the label on the Y axis */
-  bool set_ylabel(const std::string &label) {
-    std::stringstream os;
-    os << "set ylabel '" << escape_quotes(label) << "'";
-    return sendcommand(os);
-  }
+  bool flush() override {
+    if (!ok())
+      return false;
 
-  /* Set the minimum and maximum value to be displayed along the X axis */
-  void set_xrange(double min = NAN, double max = NAN) {
-    xrange = format_range(min, max);
+#ifndef _WIN32
+    SigpipeGuard guard{};
+#endif
+    broken = fflush(connection) != 0;
+    return !broken;
   }
 
-  /* Set the minimum and maximum value to be displayed along the X axis */
-  void set_yrange(double min = NAN, double max = NAN) {
-    yrange = format_range(min, max);
+  /* Return `false` once a write has failed, e.g., because Gnuplot
+   * has quit */
+  [[nodiscard]] bool ok() const override {
+    return connection != nullptr && !broken;
   }
 
-  /* Set the minimum and maximum value to be displayed along the X axis */
-  void set_zrange(double min = NAN, double max = NAN) {
-    zrange = format_range(min, max);
-  }
+  void close() override {
+    if (!connection)
+      return;
 
-  bool set_logscale(AxisScale scale) {
-    switch (scale) {
-    case AxisScale::LOGX:
-      return sendcommand("set logscale x");
-    case AxisScale::LOGY:
-      return sendcommand("set logscale y");
-    case AxisScale::LOGXY:
-      return sendcommand("set logscale xy");
-    default:
-      return sendcommand("unset logscale");
+    {
+#ifndef _WIN32
+      // pclose flushes the buffer, which fails if Gnuplot has quit
+      SigpipeGuard guard{};
+#endif
+      safe_pclose(connection);
     }
-  }
+    connection = nullptr;
 
-  template <typename T>
-  void plot(const std::vector<T> &y, const std::string &label = "",
-            LineStyle style = LineStyle::LINES) {
-    _plot(label, style, false, y);
+#ifdef _WIN32
+    // Let some time pass, so that Gnuplot can finish displaying the
+    // last plot.
+    Sleep(1000);
+#endif
   }
 
-  template <typename T, typename U>
-  void plot(const std::vector<T> &x, const std::vector<U> &y,
-            const std::string &label = "", LineStyle style = LineStyle::LINES) {
-    _plot(label, style, false, x, y);
+private:
+  static FILE *safe_popen(const char *name, const char *mode) {
+#ifdef _WIN32
+    return _popen(name, mode);
+#else
+    return popen(name, mode);
+#endif
+  }
+
+  static int safe_pclose(FILE *f) {
+#ifdef _WIN32
+    return _pclose(f);
+#else
+    return pclose(f);
+#endif
+  }
+
+  FILE *connection;
+  bool broken{false};
+};
+
+/**
+ * Backend that stores everything in memory
+ *
+ * Nothing is executed: the commands and data are appended to a string,
+ * which can be retrieved with `str()` or `take()`.
+ */
+class GnuplotBufferBackend : public GnuplotBackend {
+public:
+  bool write(Channel, const char *buf, size_t size) override {
+    buffer.append(buf, size);
+    return true;
+  }
+
+  [[nodiscard]] bool ok() const override { return true; }
+
+  [[nodiscard]] const std::string &str() const { return buffer; }
+
+  /* Return the content of the buffer and clear it */
+  std::string take() { return std::exchange(buffer, std::string{}); }
+
+  void clear() { buffer.clear(); }
+
+private:
+  std::string buffer{};
+};
+
+/**
+ * Backend that discards everything
+ *
+ * It counts the bytes written to each channel and measures the time
+ * between the first and the last write, which is useful to measure
+ * the speed of `Gnuplot` without running Gnuplot. Since nothing can
+ * be pending, `sync` always succeeds.
+ */
+class GnuplotNullBackend : public GnuplotBackend {
+public:
+  bool write(Channel channel, const char *, size_t size) override {
+    auto now = std::chrono::steady_clock::now();
+    if (writes == 0)
+      first_write = now;
+    last_write = now;
+
+    ++writes;
+    (channel == Channel::DATA ? data_bytes : command_bytes) += size;
+    return true;
+  }
+
+  bool flush() override {
+    ++flushes;
+    return true;
+  }
+
+  [[nodiscard]] bool ok() const override { return true; }
+
+  bool sync(int, std::string *) override { return true; }
+
+  /* Number of bytes written to `channel` */
+  [[nodiscard]] size_t bytes(Channel channel) const {
+    return channel == Channel::DATA ? data_bytes : command_bytes;
+  }
+
+  [[nodiscard]] size_t total_bytes() const { return command_bytes + data_bytes; }
+  [[nodiscard]] size_t num_of_writes() const { return writes; }
+  [[nodiscard]] size_t num_of_flushes() const { return flushes; }
+
+  /* Seconds elapsed between the first and the last write */
+  [[nodiscard]] double elapsed() const {
+    return std::chrono::duration<double>(last_write - first_write).count();
+  }
+
+  void reset() {
+    command_bytes = data_bytes = writes = flushes = 0;
+    first_write = last_write = std::chrono::steady_clock::time_point{};
+  }
+
+private:
+  size_t command_bytes{};
+  size_t data_bytes{};
+  size_t writes{};
+  size_t flushes{};
+  std::chrono::steady_clock::time_point first_write{};
+  std::chrono::steady_clock::time_point last_write{};
+};
+
+/**
+ * Backend that records every write without running Gnuplot
+ *
+ * Each call to `write` is stored as a separate record, together with
+ * its channel, so that tests can check the exact stream of commands
+ * and data produced by `Gnuplot`. Since nothing can be pending, `sync`
+ * always succeeds.
+ */
+class GnuplotRecordingBackend : public GnuplotBackend {
+public:
+  struct Record {
+    Channel channel;
+    std::string bytes;
+  };
+
+  bool write(Channel channel, const char *buf, size_t size) override {
+    records.push_back(Record{channel, std::string(buf, size)});
+    return true;
+  }
+
+  [[nodiscard]] bool ok() const override { return true; }
+
+  bool sync(int, std::string *) override { return true; }
+
+  [[nodiscard]] const std::vector<Record> &get_records() const {
+    return records;
+  }
+
+  /* Return everything written so far, in order */
+  [[nodiscard]] std::string str() const { return join(nullptr); }
+
+  /* Return everything written through `channel`, in order */
+  [[nodiscard]] std::string str(Channel channel) const {
+    return join(&channel);
+  }
+
+  void clear() { records.clear(); }
+
+private:
+  std::string join(const Channel *channel) const {
+    std::string result{};
+    for (const auto &record : records) {
+      if (!channel || record.channel == *channel)
+        result += record.bytes;
+    }
+    return result;
+  }
+
+  std::vector<Record> records{};
+};
+
+/**
+ * Backend that saves the commands into a Gnuplot script
+ *
+ * The file can be run later with `gnuplot FILENAME`.
+ */
+class GnuplotScriptBackend : public GnuplotBackend {
+public:
+  explicit GnuplotScriptBackend(const std::string &filename)
+      : file{std::fopen(filename.c_str(), "w")} {}
+
+  ~GnuplotScriptBackend() override { close(); }
+
+  bool write(Channel, const char *buf, size_t size) override {
+    return ok() && std::fwrite(buf, 1, size, file) == size;
+  }
+
+  bool flush() override { return ok() && std::fflush(file) == 0; }
+
+  [[nodiscard]] bool ok() const override { return file != nullptr; }
+
+  void close() override {
+    if (file) {
+      std::fclose(file);
+      file = nullptr;
+    }
+  }
+
+private:
+  FILE *file;
+};
+
+/**
+ * One entry in a session file (see `GnuplotSessionRecorder`)
+ */
+struct GnuplotSessionEvent {
+  enum class Kind : unsigned char {
+    COMMAND = 0,
+    DATA = 1,
+    FLUSH = 2,
+    SYNC = 3,
+  };
+
+  // Time elapsed since the beginning of the session
+  std::chrono::nanoseconds time{};
+  Kind kind{Kind::COMMAND};
+  std::string bytes{};
+};
+
+/**
+ * Backend that saves a timestamped copy of the session into a file
+ *
+ * Everything is forwarded to `target` (if not null), while each write,
+ * flush, and sync is appended to a binary file together with the time
+ * elapsed since the construction of the recorder. The file can be read
+ * back using `GnuplotSessionReader` or replayed with `gplotpp-replay`.
+ *
+ * The file starts with the 16-byte signature "GPLOTPP-SESSION\0" and
+ * a 32-bit version number, followed by the events. Each event is made
+ * by the time in nanoseconds (64 bits), the kind (8 bits), the number
+ * of bytes (32 bits), and the bytes themselves. Integers are stored
+ * in little-endian order.
+ */
+class GnuplotSessionRecorder : public GnuplotBackend {
+public:
+  static constexpr const char *SIGNATURE = "GPLOTPP-SESSION";
+  static const uint32_t VERSION = 1;
+
+  explicit GnuplotSessionRecorder(
+      const std::string &filename,
+      std::unique_ptr<GnuplotBackend> target = nullptr)
+      : file{std::fopen(filename.c_str(), "wb")}, target{std::move(target)},
+        start{std::chrono::steady_clock::now()} {
+    if (file) {
+      std::fwrite(SIGNATURE, 1, std::char_traits<char>::length(SIGNATURE) + 1,
+                  file);
+      write_integer(VERSION, 4);
+    }
+  }
+
+  ~GnuplotSessionRecorder() override { close(); }
+
+  bool write(Channel channel, const char *buf, size_t size) override {
+    record(channel == Channel::DATA ? GnuplotSessionEvent::Kind::DATA
+                                    : GnuplotSessionEvent::Kind::COMMAND,
+           buf, size);
+    return !target || target->write(channel, buf, size);
+  }
+
+  bool flush() override {
+    record(GnuplotSessionEvent::Kind::FLUSH, nullptr, 0);
+    if (file)
+      std::fflush(file);
+    return !target || target->flush();
+  }
+
+  [[nodiscard]] bool ok() const override {
+    return file != nullptr && (!target || target->ok());
+  }
+
+  bool sync(int timeout_ms, std::string *output) override {
+    record(GnuplotSessionEvent::Kind::SYNC, nullptr, 0);
+    return target && target->sync(timeout_ms, output);
+  }
+
+  [[nodiscard]] std::string output_file() const override {
+    return target ? target->output_file() : std::string{};
+  }
+
+  void close() override {
+    if (target)
+      target->close();
+
+    if (file) {
+      std::fclose(file);
+      file = nullptr;
+    }
+  }
+
+  /* Return the backend that receives the commands, if any */
+  [[nodiscard]] GnuplotBackend *get_target() const { return target.get(); }
+
+private:
+  void write_integer(uint64_t value, int num_of_bytes) {
+    unsigned char bytes[8];
+    for (int i = 0; i < num_of_bytes; ++i)
+      bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+    std::fwrite(bytes, 1, num_of_bytes, file);
+  }
+
+  void record(GnuplotSessionEvent::Kind kind, const char *buf, size_t size) {
+    if (!file)
+      return;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+    write_integer(static_cast<uint64_t>(elapsed.count()), 8);
+    write_integer(static_cast<uint64_t>(kind), 1);
+    write_integer(size, 4);
+    if (size > 0)
+      std::fwrite(buf, 1, size, file);
+  }
+
+  FILE *file;
+  std::unique_ptr<GnuplotBackend> target;
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Read the events saved by `GnuplotSessionRecorder`
+ *
+ * Call `next` until it returns `false`; then, `ok()` tells if the
+ * whole file was read or if it is truncated or invalid.
+ */
+class GnuplotSessionReader {
+public:
+  explicit GnuplotSessionReader(const std::string &filename)
+      : file{std::fopen(filename.c_str(), "rb")} {
+    if (!file)
+      return;
+
+    const size_t len{
+        std::char_traits<char>::length(GnuplotSessionRecorder::SIGNATURE) + 1};
+    std::string signature(len, '\0');
+    uint64_t version;
+    valid = std::fread(&signature[0], 1, len, file) == len &&
+            signature.compare(0, len - 1, GnuplotSessionRecorder::SIGNATURE) ==
+                0 &&
+            read_integer(version, 4) &&
+            version == GnuplotSessionRecorder::VERSION;
+  }
+
+  ~GnuplotSessionReader() {
+    if (file)
+      std::fclose(file);
+  }
+
+  GnuplotSessionReader(const GnuplotSessionReader &) = delete;
+  GnuplotSessionReader &operator=(const GnuplotSessionReader &) = delete;
+
+  /* Read the next event into `event`. Return `false` at the end of
+   * the file or on error */
+  bool next(GnuplotSessionEvent &event) {
+    if (!file || !valid)
+      return false;
+
+    uint64_t time, kind, size;
+    if (!read_integer(time, 8)) {
+      // A clean end of file is not an error
+      valid = std::feof(file) && !partial;
+      return false;
+    }
+
+    if (!read_integer(kind, 1) || kind > 3 || !read_integer(size, 4)) {
+      valid = false;
+      return false;
+    }
+
+    event.time = std::chrono::nanoseconds(time);
+    event.kind = static_cast<GnuplotSessionEvent::Kind>(kind);
+    event.bytes.resize(size);
+    if (size > 0 && std::fread(&event.bytes[0], 1, size, file) != size) {
+      valid = false;
+      return false;
+    }
+
+    return true;
+  }
+
+  /* Return `false` if the file could not be opened or is invalid */
+  [[nodiscard]] bool ok() const { return file != nullptr && valid; }
+
+private:
+  bool read_integer(uint64_t &value, int num_of_bytes) {
+    unsigned char bytes[8];
+    size_t count = std::fread(bytes, 1, num_of_bytes, file);
+    partial = count > 0 && count < static_cast<size_t>(num_of_bytes);
+    if (count != static_cast<size_t>(num_of_bytes))
+      return false;
+
+    value = 0;
+    for (int i = 0; i < num_of_bytes; ++i)
+      value |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    return true;
+  }
+
+  FILE *file;
+  bool valid{false};
+  bool partial{false};
+};
+
+/**
+ * How to schedule a new Gnuplot process (see `GnuplotProcessBackend`)
+ *
+ * The options are applied by the parent as soon as the process has
+ * been started. Only `nice` is supported on Mac OS X, and nothing on
+ * Windows.
+ */
+struct GnuplotLaunchOptions {
+  enum class IoClass {
+    UNCHANGED,
+    REALTIME,
+    BEST_EFFORT,
+    IDLE,
+  };
+
+  // When to start Gnuplot; only used by the `Gnuplot` constructor
+  enum class Startup {
+    // In the constructor
+    IMMEDIATE,
+    // When the first command that needs the process is sent
+    LAZY,
+    // In a background thread, so that the constructor returns at once.
+    // Commands and plots are kept in memory until Gnuplot is running
+    BACKGROUND,
+  };
+
+  Startup startup{Startup::IMMEDIATE};
+  // Niceness of the process (larger values mean lower priority)
+  std::optional<int> nice{};
+  // CPUs where the process can run; if empty, any CPU
+  std::vector<int> cpus{};
+  // I/O scheduling class and priority (0 = highest, 7 = lowest)
+  IoClass io_class{IoClass::UNCHANGED};
+  int io_level{4};
+  // Maximum size of the virtual memory (RLIMIT_AS) in bytes, or zero
+  size_t max_address_space{};
+};
+
+#ifndef _WIN32
+class GnuplotZygote;
+
+/**
+ * Backend running Gnuplot as a child process (not available on Windows)
+ *
+ * Unlike `GnuplotPipeBackend`, this starts Gnuplot with `posix_spawn`
+ * and sets up two more pipes going in the opposite direction: one is
+ * attached to file descriptor 3 of the child and used by `sync`, the
+ * other to file descriptor 4 and used as `output_file()`.
+ */
+class GnuplotProcessBackend : public GnuplotBackend {
+public:
+  // File descriptor in the Gnuplot process where the replies to our
+  // synchronization requests are written
+  static const int REPLY_FD = 3;
+
+  // File descriptor in the Gnuplot process used by `output_file()`
+  static const int OUTPUT_FD = 4;
+
+  explicit GnuplotProcessBackend(const std::string &command,
+                                 const GnuplotLaunchOptions &options = {}) {
+    if (spawn(command))
+      options_applied = apply_options(child_pid, options);
+  }
+
+  /* Ask `zygote` to start Gnuplot instead of doing it ourselves. See
+   * `GnuplotZygote` */
+  GnuplotProcessBackend(GnuplotZygote &zygote, const std::string &command,
+                        const GnuplotLaunchOptions &options = {});
+
+  ~GnuplotProcessBackend() override { close(); }
+
+  bool write(Channel, const char *buf, size_t size) override {
+    if (!ok())
+      return false;
+
+    SigpipeGuard guard{};
+    broken = fwrite(buf, 1, size, connection) != size;
+    if (broken)
+      child_running();
+    return !broken;
+  }
+
+  bool flush() override {
+    if (!ok())
+      return false;
+
+    SigpipeGuard guard{};
+    broken = fflush(connection) != 0;
+    if (broken)
+      child_running();
+    return !broken;
+  }
+
+  /* Return `false` if Gnuplot has quit or a write has failed. This
+   * never blocks. Since this is called before every write, the process
+   * is checked at most once every `LIVENESS_INTERVAL`, so it might
+   * take that long to notice that Gnuplot has quit */
+  [[nodiscard]] bool ok() const override {
+    return connection != nullptr && !broken && child_alive();
+  }
+
+  // How often `ok()` asks the system whether Gnuplot is still running
+  static constexpr std::chrono::milliseconds LIVENESS_INTERVAL{50};
+
+  /* If Gnuplot has quit, return `true` and set `status` as `waitpid`
+   * would do */
+  bool exited(int &status) const {
+    if (child_running())
+      return false;
+    status = exit_status;
+    return child_exited;
+  }
+
+  bool sync(int timeout_ms, std::string *output) override {
+    if (!ok() || reply_fd < 0)
+      return false;
+
+    std::string sentinel{next_sentinel()};
+    if (!write_command(print_sentinel(reply_file(), sentinel)))
+      return false;
+
+    // Once the reader thread is running, only it can read `reply_fd`
+    if (reader.joinable())
+      return wait_for_reply(sentinel, timeout_ms, output);
+
+    return wait_for_line(reply_fd, reply_buffer, sentinel, timeout_ms,
+                         output_fd, output);
+  }
+
+  bool set_ack_handler(AckHandler handler) override {
+    std::lock_guard<std::mutex> lock{reply_mutex};
+    ack_handler = std::move(handler);
+    return true;
+  }
+
+  /* The first call starts a thread that reads the replies from
+   * Gnuplot, so that acknowledgements are noticed immediately */
+  bool request_ack(uint64_t seq) override {
+    if (!ok() || reply_fd < 0)
+      return false;
+
+    if (!reader.joinable())
+      reader = std::thread{[this]() { read_replies(); }};
+
+    std::stringstream ack;
+    ack << ACK_PREFIX << seq;
+    return write_command(print_sentinel(reply_file(), ack.str()));
+  }
+
+  [[nodiscard]] std::string output_file() const override {
+    std::stringstream os;
+    os << "/dev/fd/" << OUTPUT_FD;
+    return os.str();
+  }
+
+  /* Close the pipe and wait for Gnuplot to quit. Once Gnuplot reads
+   * the end of its input, it closes any output file, so after this
+   * function returns all the plots have been finalized. */
+  void close() override {
+    if (connection) {
+      // fclose flushes the buffer, which fails if Gnuplot has quit
+      SigpipeGuard guard{};
+      fclose(connection);
+      connection = nullptr;
+    }
+
+    child_running(true);
+
+    // Processes started by Gnuplot might keep the reply pipe open, so
+    // do not wait for the end of the file
+    if (reader.joinable()) {
+      stop_reader = true;
+      reader.join();
+    }
+
+    // Close these only now, as Gnuplot would receive a SIGPIPE if it
+    // were still printing something here
+    for (int *fd : {&reply_fd, &output_fd, &status_fd}) {
+      if (*fd >= 0) {
+        ::close(*fd);
+        *fd = -1;
+      }
+    }
+  }
+
+  /* Return `false` if some of the `GnuplotLaunchOptions` passed to the
+   * constructor could not be applied */
+  [[nodiscard]] bool launch_options_applied() const { return options_applied; }
+
+  /* Apply `options` to process `pid`. Return `false` if any of them
+   * failed or is not supported on this platform */
+  static bool apply_options(pid_t pid, const GnuplotLaunchOptions &options) {
+    bool result{true};
+
+    if (options.nice)
+      result = setpriority(PRIO_PROCESS, static_cast<id_t>(pid),
+                           *options.nice) == 0 &&
+               result;
+
+#ifdef __linux__
+    if (!options.cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (int cpu : options.cpus)
+        CPU_SET(cpu, &set);
+      result = sched_setaffinity(pid, sizeof(set), &set) == 0 && result;
+    }
+
+    if (options.io_class != GnuplotLaunchOptions::IoClass::UNCHANGED) {
+      // See ioprio_set(2); glibc provides no wrapper
+      const int IOPRIO_WHO_PROCESS = 1;
+      const int IOPRIO_CLASS_SHIFT = 13;
+      const int ioprio{(static_cast<int>(options.io_class)
+                        << IOPRIO_CLASS_SHIFT) |
+                       options.io_level};
+      result =
+          syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, ioprio) == 0 &&
+          result;
+    }
+
+    if (options.max_address_space > 0) {
+      rlimit limit{};
+      limit.rlim_cur = limit.rlim_max =
+          static_cast<rlim_t>(options.max_address_space);
+      result = prlimit(pid, RLIMIT_AS, &limit, nullptr) == 0 && result;
+    }
+#else
+    if (!options.cpus.empty() ||
+        options.io_class != GnuplotLaunchOptions::IoClass::UNCHANGED ||
+        options.max_address_space > 0)
+      result = false;
+#endif
+
+    return result;
+  }
+
+  /* Return the PID of the Gnuplot process, or -1 */
+  [[nodiscard]] int pid() const override {
+    return child_exited ? -1 : child_pid;
+  }
+
+private:
+  // Like `child_running()`, but skip the check if the last one was
+  // made less than `LIVENESS_INTERVAL` ago
+  bool child_alive() const {
+    if (child_exited)
+      return false;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now < next_liveness_check)
+      return true;
+
+    next_liveness_check = now + LIVENESS_INTERVAL;
+    return child_running();
+  }
+
+  // Check if the child has quit, waiting for it only if `block` is
+  // true. The child is reaped here, so nobody must wait for it again
+  bool child_running(bool block = false) const {
+    if (child_pid <= 0 || child_exited)
+      return false;
+
+    int status{};
+    if (status_fd >= 0) {
+      // The child belongs to a `GnuplotZygote`, which sends us its
+      // exit status (or closes the pipe if it quits itself)
+      pollfd pfd{status_fd, POLLIN, 0};
+      if (!block && poll(&pfd, 1, 0) <= 0)
+        return true;
+
+      ssize_t count;
+      while ((count = read(status_fd, &status, sizeof(status))) < 0 &&
+             errno == EINTR) {
+      }
+      child_exited = true;
+      exit_status = count == sizeof(status) ? status : 0;
+      return false;
+    }
+
+    pid_t result;
+    while ((result = waitpid(child_pid, &status, block ? 0 : WNOHANG)) < 0 &&
+           errno == EINTR) {
+    }
+
+    if (result == child_pid || (result < 0 && errno == ECHILD)) {
+      child_exited = true;
+      exit_status = status;
+    }
+    return !child_exited;
+  }
+
+  static std::string reply_file() {
+    std::stringstream os;
+    os << "/dev/fd/" << REPLY_FD;
+    return os.str();
+  }
+
+  // Body of the reader thread: dispatch acknowledgements and queue the
+  // other lines for `wait_for_reply`
+  void read_replies() {
+    std::string buffer{};
+    while (!stop_reader) {
+      pollfd pfd{reply_fd, POLLIN, 0};
+      int result = poll(&pfd, 1, 50);
+      if (result == 0 || (result < 0 && errno == EINTR))
+        continue;
+
+      char buf[256];
+      ssize_t count = result > 0 ? read(reply_fd, buf, sizeof(buf)) : -1;
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        break; // Gnuplot has quit
+
+      buffer.append(buf, static_cast<size_t>(count));
+      size_t newline;
+      while ((newline = buffer.find('\n')) != std::string::npos) {
+        std::string line{buffer.substr(0, newline)};
+        buffer.erase(0, newline + 1);
+
+        const size_t prefix_len{std::char_traits<char>::length(ACK_PREFIX)};
+        if (line.compare(0, prefix_len, ACK_PREFIX) == 0) {
+          // Ignore malformed lines, e.g., printed by the user
+          uint64_t seq{};
+          if (!parse_seq(line.c_str() + prefix_len, seq))
+            continue;
+
+          AckHandler handler;
+          {
+            std::lock_guard<std::mutex> lock{reply_mutex};
+            handler = ack_handler;
+          }
+          if (handler)
+            handler(seq);
+        } else {
+          std::lock_guard<std::mutex> lock{reply_mutex};
+          reply_lines.push_back(std::move(line));
+          reply_cv.notify_all();
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock{reply_mutex};
+    reply_eof = true;
+    reply_cv.notify_all();
+  }
+
+  // Parse the decimal number that makes up the whole of `str`
+  static bool parse_seq(const char *str, uint64_t &seq) {
+    if (*str < '0' || *str > '9')
+      return false;
+
+    char *end{};
+    errno = 0;
+    const unsigned long long value{std::strtoull(str, &end, 10)};
+    if (errno != 0 || *end != '\0')
+      return false;
+
+    seq = static_cast<uint64_t>(value);
+    return true;
+  }
+
+  // Same as `wait_for_line`, but using the lines queued by the reader
+  bool wait_for_reply(const std::string &expected, int timeout_ms,
+                      std::string *output) {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    std::unique_lock<std::mutex> lock{reply_mutex};
+    while (true) {
+      while (!reply_lines.empty()) {
+        std::string line{std::move(reply_lines.front())};
+        reply_lines.pop_front();
+        if (line == expected) {
+          lock.unlock();
+          if (output)
+            read_available(output_fd, *output);
+          return true;
+        }
+      }
+
+      if (reply_eof || (timeout_ms >= 0 && clock::now() >= deadline))
+        return false;
+
+      // Wake up now and then to drain the output pipe, otherwise
+      // Gnuplot could block before printing the sentinel
+      auto wait = std::chrono::milliseconds(output ? 10 : 100);
+      if (timeout_ms >= 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - clock::now());
+        wait = std::min(wait, left + std::chrono::milliseconds(1));
+      }
+      reply_cv.wait_for(lock, wait);
+
+      if (output) {
+        lock.unlock();
+        read_available(output_fd, *output);
+        lock.lock();
+      }
+    }
+  }
+
+  // Make sure that `fd` does not clash with the descriptors we are
+  // going to set up in the child process (0–OUTPUT_FD)
+  static int move_above_reserved_fds(int fd) {
+    if (fd > OUTPUT_FD)
+      return fd;
+
+    int new_fd = fcntl(fd, F_DUPFD_CLOEXEC, OUTPUT_FD + 1);
+    ::close(fd);
+    return new_fd;
+  }
+
+  // Create a pipe whose ends are not inherited by other child processes
+  static bool safe_pipe(int fds[2]) {
+    if (pipe(fds) != 0)
+      return false;
+
+    for (int i : {0, 1}) {
+      fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+      fds[i] = move_above_reserved_fds(fds[i]);
+    }
+
+    return fds[0] >= 0 && fds[1] >= 0;
+  }
+
+  bool spawn(const std::string &command) {
+    int cmd_fd{-1};
+    if (!launch(command, child_pid, cmd_fd, reply_fd, output_fd))
+      return false;
+
+    return adopt(cmd_fd);
+  }
+
+  // Take ownership of the write end of the command pipe
+  bool adopt(int cmd_fd) {
+    connection = fdopen(cmd_fd, "w");
+    if (!connection)
+      ::close(cmd_fd);
+    return connection != nullptr;
+  }
+
+  // Start `command` with its standard input, `REPLY_FD`, and
+  // `OUTPUT_FD` connected to three pipes, and return the other ends.
+  // This is used by `GnuplotZygote` too
+  static bool launch(const std::string &command, pid_t &pid, int &cmd_fd,
+                     int &reply_fd, int &output_fd) {
+    int cmd_pipe[2], reply_pipe[2], output_pipe[2];
+    if (!safe_pipe(cmd_pipe))
+      return false;
+
+    if (!safe_pipe(reply_pipe)) {
+      ::close(cmd_pipe[0]);
+      ::close(cmd_pipe[1]);
+      return false;
+    }
+
+    if (!safe_pipe(output_pipe)) {
+      for (int fd : {cmd_pipe[0], cmd_pipe[1], reply_pipe[0], reply_pipe[1]})
+        ::close(fd);
+      return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, cmd_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, reply_pipe[1], REPLY_FD);
+    posix_spawn_file_actions_adddup2(&actions, output_pipe[1], OUTPUT_FD);
+
+    // Use "exec" so that the shell is replaced by Gnuplot and
+    // `child_pid` refers to the Gnuplot process itself
+    std::string shell_cmd{"exec " + command};
+    char sh_name[] = "sh";
+    char sh_flag[] = "-c";
+    char *argv[] = {sh_name, sh_flag, &shell_cmd[0], nullptr};
+
+    // Gnuplot must die on a broken pipe as usual, even if we ignore
+    // SIGPIPE (like `GnuplotZygote`) or block it (`SigpipeGuard`)
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t sigpipe{}, mask{};
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_SETMASK, nullptr, &mask);
+    sigdelset(&mask, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigpipe);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+                                        POSIX_SPAWN_SETSIGMASK);
+
+    int err = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    ::close(cmd_pipe[0]);
+    ::close(reply_pipe[1]);
+    ::close(output_pipe[1]);
+
+    if (err != 0) {
+      ::close(cmd_pipe[1]);
+      ::close(reply_pipe[0]);
+      ::close(output_pipe[0]);
+      pid = -1;
+      return false;
+    }
+
+    // Once the sentinel has arrived, we must be able to read what
+    // is left in the output pipe without blocking
+    fcntl(output_pipe[0], F_SETFL, O_NONBLOCK);
+
+    cmd_fd = cmd_pipe[1];
+    reply_fd = reply_pipe[0];
+    output_fd = output_pipe[0];
+    return true;
+  }
+
+  FILE *connection{};
+  bool broken{false};
+  bool options_applied{true};
+  pid_t child_pid{-1};
+  mutable bool child_exited{false};
+  mutable int exit_status{};
+  mutable std::chrono::steady_clock::time_point next_liveness_check{};
+  int reply_fd{-1};
+  int output_fd{-1};
+  int status_fd{-1};
+  std::string reply_buffer{};
+
+  // Used only after the first call to `request_ack`
+  std::thread reader{};
+  std::atomic<bool> stop_reader{false};
+  std::mutex reply_mutex{};
+  std::condition_variable reply_cv{};
+  std::deque<std::string> reply_lines{};
+  bool reply_eof{false};
+  AckHandler ack_handler{};
+
+  friend class GnuplotZygote;
+};
+
+/**
+ * A small process that starts Gnuplot on behalf of this one
+ *
+ * `posix_spawn` gets slower as the memory used by the process that
+ * calls it grows. A zygote is forked when the program is still small
+ * (call `start()` at the beginning of `main`, before creating any
+ * thread); later, `GnuplotProcessBackend` asks it to start Gnuplot
+ * through a Unix socket and receives the ends of the pipes with
+ * `SCM_RIGHTS`. The zygote sends back the exit status of each Gnuplot
+ * process as well, so that `GnuplotProcessBackend::ok()` and
+ * `GnuplotProcessBackend::close()` work as usual.
+ *
+ * Once `start()` has been called, every `Gnuplot` object uses the
+ * zygote. Not available on Windows.
+ */
+class GnuplotZygote {
+public:
+  // What `spawn` returns: the file descriptors belong to the caller
+  struct Process {
+    pid_t pid{-1};
+    int cmd_fd{-1};
+    int reply_fd{-1};
+    int output_fd{-1};
+    // The exit status of the process is written here (see `waitpid`)
+    int status_fd{-1};
+  };
+
+  GnuplotZygote() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      return;
+
+    zygote_pid = fork();
+    if (zygote_pid == 0) {
+      ::close(fds[0]);
+      serve(fds[1]);
+      _exit(0);
+    }
+
+    ::close(fds[1]);
+    if (zygote_pid < 0) {
+      ::close(fds[0]);
+      return;
+    }
+
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    const int one{1};
+    setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    sock = fds[0];
+  }
+
+  GnuplotZygote(const GnuplotZygote &) = delete;
+  GnuplotZygote &operator=(const GnuplotZygote &) = delete;
+
+  /* The zygote quits once the socket is closed; the Gnuplot processes
+   * it has started keep running */
+  ~GnuplotZygote() {
+    if (sock >= 0)
+      ::close(sock);
+
+    if (zygote_pid > 0) {
+      while (waitpid(zygote_pid, nullptr, 0) < 0 && errno == EINTR) {
+      }
+    }
+  }
+
+  [[nodiscard]] bool running() const { return sock >= 0; }
+
+  /* Return the PID of the zygote, or -1 */
+  [[nodiscard]] pid_t pid() const { return zygote_pid; }
+
+  /* Start `command` and fill `process`. This is thread-safe */
+  bool spawn(const std::string &command, Process &process) {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (sock < 0)
+      return false;
+
+    const uint32_t size{static_cast<uint32_t>(command.size())};
+    if (!send_all(sock, &size, sizeof(size)) ||
+        !send_all(sock, command.data(), command.size()))
+      return false;
+
+    int32_t pid{-1};
+    int fds[NUM_OF_FDS];
+    if (!receive(sock, pid, fds))
+      return false;
+
+    process.pid = pid;
+    process.cmd_fd = fds[0];
+    process.reply_fd = fds[1];
+    process.output_fd = fds[2];
+    process.status_fd = fds[3];
+    return true;
+  }
+
+  /* Start the zygote used by every `Gnuplot` object created
+   * afterwards. Return `false` if it could not be started */
+  static bool start() {
+    auto zygote = std::make_shared<GnuplotZygote>();
+    if (!zygote->running())
+      return false;
+
+    set_global(std::move(zygote));
+    return true;
+  }
+
+  static void set_global(std::shared_ptr<GnuplotZygote> zygote) {
+    std::lock_guard<std::mutex> lock{global_mutex()};
+    global_zygote() = std::move(zygote);
+  }
+
+  [[nodiscard]] static std::shared_ptr<GnuplotZygote> get_global() {
+    std::lock_guard<std::mutex> lock{global_mutex()};
+    return global_zygote();
+  }
+
+private:
+  // Command pipe, reply pipe, output pipe, and exit status
+  static const int NUM_OF_FDS = 4;
+
+#ifdef MSG_NOSIGNAL
+  static const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+  static const int SEND_FLAGS = 0;
+#endif
+
+  static bool send_all(int fd, const void *buf, size_t size) {
+    const char *ptr{static_cast<const char *>(buf)};
+    while (size > 0) {
+      ssize_t count = send(fd, ptr, size, SEND_FLAGS);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false;
+      ptr += count;
+      size -= static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  static bool read_all(int fd, void *buf, size_t size) {
+    char *ptr{static_cast<char *>(buf)};
+    while (size > 0) {
+      ssize_t count = read(fd, ptr, size);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false;
+      ptr += count;
+      size -= static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  // Send the PID of a new process and, if it is valid, the descriptors
+  static bool reply(int fd, int32_t pid, const int fds[NUM_OF_FDS]) {
+    iovec iov{&pid, sizeof(pid)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * NUM_OF_FDS)]{};
+    if (pid > 0) {
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * NUM_OF_FDS);
+      std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * NUM_OF_FDS);
+    }
+
+    ssize_t count;
+    while ((count = sendmsg(fd, &msg, SEND_FLAGS)) < 0 && errno == EINTR) {
+    }
+    return count == sizeof(pid);
+  }
+
+  static bool receive(int fd, int32_t &pid, int fds[NUM_OF_FDS]) {
+    iovec iov{&pid, sizeof(pid)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * NUM_OF_FDS)]{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t count;
+    while ((count = recvmsg(fd, &msg, 0)) < 0 && errno == EINTR) {
+    }
+    if (count != sizeof(pid) || pid <= 0)
+      return false;
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * NUM_OF_FDS))
+      return false;
+
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * NUM_OF_FDS);
+    for (int i{}; i < NUM_OF_FDS; ++i)
+      fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    return true;
+  }
+
+  // Written by the SIGCHLD handler of the zygote
+  static int &wakeup_fd() {
+    static int fd{-1};
+    return fd;
+  }
+
+  // Close every descriptor inherited from the parent but `keep`:
+  // otherwise, the pipes of Gnuplot processes started by the parent
+  // would never reach the end of the file
+  static void close_inherited_fds(int keep) {
+    std::vector<int> fds{};
+    if (DIR *dir = opendir("/dev/fd")) {
+      while (dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] != '.')
+          fds.push_back(std::atoi(entry->d_name));
+      }
+      closedir(dir);
+    }
+
+    for (int fd : fds) {
+      if (fd > STDERR_FILENO && fd != keep)
+        ::close(fd);
+    }
+  }
+
+  // Main loop of the zygote: start a process for each request, and
+  // report the exit status of the processes that have quit
+  static void serve(int fd) {
+    close_inherited_fds(fd);
+
+    int wakeup[2];
+    if (pipe(wakeup) != 0)
+      return;
+    for (int end : wakeup) {
+      fcntl(end, F_SETFD, FD_CLOEXEC);
+      fcntl(end, F_SETFL, O_NONBLOCK);
+    }
+    wakeup_fd() = wakeup[1];
+
+    struct sigaction action {};
+    action.sa_handler = [](int) {
+      const int saved_errno{errno};
+      const char byte{};
+      (void)!::write(wakeup_fd(), &byte, 1);
+      errno = saved_errno;
+    };
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    // PID of each Gnuplot process → where to write its exit status
+    std::map<pid_t, int> children{};
+    while (true) {
+      pollfd pfds[2]{{fd, POLLIN, 0}, {wakeup[0], POLLIN, 0}};
+      if (poll(pfds, 2, -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+
+      if (pfds[1].revents != 0) {
+        char buf[64];
+        while (read(wakeup[0], buf, sizeof(buf)) > 0) {
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+          auto it = children.find(pid);
+          if (it == children.end())
+            continue;
+          (void)!::write(it->second, &status, sizeof(status));
+          ::close(it->second);
+          children.erase(it);
+        }
+      }
+
+      if (pfds[0].revents != 0) {
+        uint32_t size;
+        if (!read_all(fd, &size, sizeof(size)))
+          break; // The parent has gone
+
+        std::string command(size, '\0');
+        if (!read_all(fd, &command[0], size))
+          break;
+
+        pid_t pid{-1};
+        int fds[NUM_OF_FDS]{-1, -1, -1, -1};
+        int status_pipe[2];
+        if (pipe(status_pipe) == 0) {
+          fcntl(status_pipe[0], F_SETFD, FD_CLOEXEC);
+          fcntl(status_pipe[1], F_SETFD, FD_CLOEXEC);
+          if (GnuplotProcessBackend::launch(command, pid, fds[0], fds[1],
+                                            fds[2])) {
+            fds[3] = status_pipe[0];
+            children[pid] = status_pipe[1];
+          } else {
+            ::close(status_pipe[1]);
+            ::close(status_pipe[0]);
+            pid = -1;
+          }
+        }
+
+        const bool sent{reply(fd, static_cast<int32_t>(pid), fds)};
+        for (int i{}; i < NUM_OF_FDS; ++i) {
+          if (fds[i] >= 0)
+            ::close(fds[i]);
+        }
+        if (!sent)
+          break;
+      }
+    }
+  }
+
+  static std::mutex &global_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static std::shared_ptr<GnuplotZygote> &global_zygote() {
+    static std::shared_ptr<GnuplotZygote> zygote;
+    return zygote;
+  }
+
+  int sock{-1};
+  pid_t zygote_pid{-1};
+  std::mutex mutex{};
+};
+
+inline GnuplotProcessBackend::GnuplotProcessBackend(
+    GnuplotZygote &zygote, const std::string &command,
+    const GnuplotLaunchOptions &options) {
+  GnuplotZygote::Process process{};
+  if (!zygote.spawn(command, process))
+    return;
+
+  child_pid = process.pid;
+  reply_fd = process.reply_fd;
+  output_fd = process.output_fd;
+  status_fd = process.status_fd;
+  if (adopt(process.cmd_fd))
+    options_applied = apply_options(child_pid, options);
+}
+
+/**
+ * Backend connected to a Gnuplot process through a Unix socket
+ *
+ * This is useful to talk with a long-running Gnuplot started by
+ * another program, e.g.:
+ *
+ *     socat UNIX-LISTEN:/tmp/gnuplot.sock,fork EXEC:gnuplot
+ *
+ * If the server sends the standard output of Gnuplot back through the
+ * socket (as `socat` does), `sync` is supported as well. Not
+ * available on Windows.
+ */
+class GnuplotSocketBackend : public GnuplotBackend {
+public:
+  explicit GnuplotSocketBackend(const std::string &path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+      return;
+
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+        0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  ~GnuplotSocketBackend() override { close(); }
+
+  bool write(Channel, const char *buf, size_t size) override {
+    while (size > 0) {
+      if (!ok())
+        return false;
+
+      ssize_t count = send(fd, buf, size, send_flags());
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0) {
+        close();
+        return false;
+      }
+
+      buf += count;
+      size -= static_cast<size_t>(count);
+    }
+
+    return true;
+  }
+
+  [[nodiscard]] bool ok() const override { return fd >= 0; }
+
+  bool sync(int timeout_ms, std::string *output) override {
+    if (!ok() || output)
+      return false;
+
+    // The standard output of Gnuplot is sent back through the socket
+    std::string sentinel{next_sentinel()};
+    if (!write_command(print_sentinel("-", sentinel)))
+      return false;
+
+    return wait_for_line(fd, reply_buffer, sentinel, timeout_ms);
+  }
+
+  void close() override {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+private:
+  static int send_flags() {
+#ifdef MSG_NOSIGNAL
+    return MSG_NOSIGNAL;
+#else
+    return 0;
+#endif
+  }
+
+  int fd{-1};
+  std::string reply_buffer{};
+};
+
+/**
+ * A ring buffer of bytes in shared memory, with one writer and one
+ * reader that may live in different processes
+ *
+ * The writer calls `create` and passes `fd()` to the reader (e.g.,
+ * with `SCM_RIGHTS`), which calls `attach`. This is used by
+ * `GnuplotDaemonBackend` to send datablocks to `GnuplotDaemon` without
+ * copying them through a socket. Not available on Windows.
+ */
+class GnuplotSharedRing {
+public:
+  GnuplotSharedRing() = default;
+  GnuplotSharedRing(const GnuplotSharedRing &) = delete;
+  GnuplotSharedRing &operator=(const GnuplotSharedRing &) = delete;
+
+  ~GnuplotSharedRing() {
+    if (header)
+      munmap(header, sizeof(Header) + ring_capacity);
+    if (ring_fd >= 0)
+      ::close(ring_fd);
+  }
+
+  /* Allocate a ring able to hold `capacity` bytes */
+  bool create(size_t capacity) {
+#ifdef __linux__
+    int fd = memfd_create("gplotpp-ring", MFD_CLOEXEC);
+#else
+    std::stringstream name;
+    name << "/gplotpp-ring-" << getpid() << "-" << next_id()++;
+    int fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+      shm_unlink(name.str().c_str());
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (fd < 0)
+      return false;
+
+    if (ftruncate(fd, static_cast<off_t>(sizeof(Header) + capacity)) != 0 ||
+        !map(fd, capacity)) {
+      ::close(fd);
+      return false;
+    }
+
+    new (header) Header{};
+    header->capacity = capacity;
+    return true;
+  }
+
+  /* Use the ring created by another process, taking ownership of `fd` */
+  bool attach(int fd) {
+    struct stat info {};
+    if (fstat(fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) <= sizeof(Header) ||
+        !map(fd, static_cast<size_t>(info.st_size) - sizeof(Header))) {
+      ::close(fd);
+      return false;
+    }
+
+    return header->capacity == ring_capacity;
+  }
+
+  [[nodiscard]] int fd() const { return ring_fd; }
+  [[nodiscard]] size_t capacity() const { return ring_capacity; }
+
+  /* Copy as many bytes of `buf` as there is room for, and return how
+   * many. Only the writer can call this */
+  size_t write(const char *buf, size_t size) {
+    const uint64_t head{header->head.load(std::memory_order_relaxed)};
+    const uint64_t tail{header->tail.load(std::memory_order_acquire)};
+    size = std::min(size, ring_capacity - static_cast<size_t>(head - tail));
+
+    const size_t start{static_cast<size_t>(head % ring_capacity)};
+    const size_t first{std::min(size, ring_capacity - start)};
+    std::memcpy(data + start, buf, first);
+    std::memcpy(data, buf + first, size - first);
+
+    header->head.store(head + size, std::memory_order_release);
+    return size;
+  }
+
+  /* Pass the next `size` bytes to `consume(const char *, size_t)` (once
+   * or twice, if they wrap around) and free them. Return `false` if
+   * fewer bytes are available. Only the reader can call this */
+  template <typename Function> bool read(size_t size, Function consume) {
+    const uint64_t head{header->head.load(std::memory_order_acquire)};
+    const uint64_t tail{header->tail.load(std::memory_order_relaxed)};
+    if (head - tail > ring_capacity || head - tail < size)
+      return false;
+
+    const size_t start{static_cast<size_t>(tail % ring_capacity)};
+    const size_t first{std::min(size, ring_capacity - start)};
+    bool result = consume(data + start, first);
+    if (first < size)
+      result = consume(data, size - first) && result;
+
+    header->tail.store(tail + size, std::memory_order_release);
+    return result;
+  }
+
+private:
+  struct Header {
+    std::atomic<uint64_t> head{};
+    std::atomic<uint64_t> tail{};
+    uint64_t capacity{};
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "GnuplotSharedRing needs lock-free 64-bit atomics");
+
+#ifndef __linux__
+  static std::atomic<uint64_t> &next_id() {
+    static std::atomic<uint64_t> id{};
+    return id;
+  }
+#endif
+
+  bool map(int fd, size_t capacity) {
+    void *ptr = mmap(nullptr, sizeof(Header) + capacity,
+                     PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+      return false;
+
+    ring_fd = fd;
+    ring_capacity = capacity;
+    header = static_cast<Header *>(ptr);
+    data = static_cast<char *>(ptr) + sizeof(Header);
+    return true;
+  }
+
+  int ring_fd{-1};
+  size_t ring_capacity{};
+  Header *header{};
+  char *data{};
+};
+
+/**
+ * Messages exchanged by `GnuplotDaemonBackend` and `GnuplotDaemon`
+ *
+ * Each message is made by a one-byte type, the size of the payload
+ * (32-bit, little-endian on every supported platform) and the payload.
+ * `HELLO` carries the file descriptor of the `GnuplotSharedRing`;
+ * `DATA` tells how many bytes have been put in the ring since the
+ * previous one, so that datablocks and commands are sent to Gnuplot in
+ * the same order as they were written. What Gnuplot writes into the
+ * output file during a `SYNC` is sent back in `OUTPUT` messages of at
+ * most `OUTPUT_CHUNK` bytes, followed by `SYNC_DONE`; thus its size is
+ * not limited by `MAX_PAYLOAD`.
+ */
+struct GnuplotDaemonProtocol {
+  enum class Message : uint8_t {
+    // Client → daemon
+    HELLO,
+    COMMAND,
+    DATA,
+    FLUSH,
+    SYNC,
+    DRAIN,
+    // Daemon → client
+    WELCOME,
+    SYNC_DONE,
+    DRAINED,
+    OUTPUT,
+  };
+
+  // Larger payloads are refused (datablocks go through the ring)
+  static const uint32_t MAX_PAYLOAD = 64 << 20;
+
+  // Size of the pieces in which the output of `SYNC` is sent
+  static constexpr size_t OUTPUT_CHUNK = 1 << 20;
+
+  static int connect_to(const std::string &path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+      return -1;
+
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    const int one{1};
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+        0) {
+      // Callers might need to know why `connect` failed
+      const int error{errno};
+      ::close(fd);
+      errno = error;
+      return -1;
+    }
+
+    return fd;
+  }
+
+  /* Send a message, together with `pass_fd` if it is not negative */
+  static bool send_message(int fd, Message type, const char *payload,
+                           size_t size, int pass_fd = -1) {
+    if (size > MAX_PAYLOAD)
+      return false;
+
+    char head[HEADER_SIZE];
+    const uint32_t size32{static_cast<uint32_t>(size)};
+    head[0] = static_cast<char>(type);
+    std::memcpy(head + 1, &size32, sizeof(size32));
+
+    iovec iov[2]{{head, sizeof(head)},
+                 {const_cast<char *>(payload), size}};
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = size > 0 ? 2 : 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    if (pass_fd >= 0) {
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      std::memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+
+    ssize_t count;
+    while ((count = sendmsg(fd, &msg, send_flags())) < 0 && errno == EINTR) {
+    }
+    if (count < 0)
+      return false;
+
+    // The rest of the message, if the socket buffer was full
+    size_t sent{static_cast<size_t>(count)};
+    if (sent < sizeof(head)) {
+      if (!send_all(fd, head + sent, sizeof(head) - sent))
+        return false;
+      sent = sizeof(head);
+    }
+    return send_all(fd, payload + (sent - sizeof(head)),
+                    size - (sent - sizeof(head)));
+  }
+
+  /* Receive a message; if `received_fd` is not null, it is set to the
+   * file descriptor sent with the message, or -1 */
+  static bool receive_message(int fd, Message &type, std::string &payload,
+                              int *received_fd = nullptr) {
+    char head[HEADER_SIZE];
+    iovec iov{head, sizeof(head)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t count;
+    while ((count = recvmsg(fd, &msg, 0)) < 0 && errno == EINTR) {
+    }
+    if (count <= 0)
+      return false;
+
+    int passed_fd{-1};
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      std::memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(int));
+      fcntl(passed_fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    if (received_fd)
+      *received_fd = passed_fd;
+    else if (passed_fd >= 0)
+      ::close(passed_fd);
+
+    uint32_t size;
+    if (!read_all(fd, head + count, sizeof(head) - static_cast<size_t>(count)))
+      return false;
+    std::memcpy(&size, head + 1, sizeof(size));
+    if (size > MAX_PAYLOAD)
+      return false;
+
+    type = static_cast<Message>(head[0]);
+    payload.resize(size);
+    return read_all(fd, &payload[0], size);
+  }
+
+private:
+  static const size_t HEADER_SIZE = 1 + sizeof(uint32_t);
+
+  static int send_flags() {
+#ifdef MSG_NOSIGNAL
+    return MSG_NOSIGNAL;
+#else
+    return 0;
+#endif
+  }
+
+  static bool send_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+      ssize_t count = send(fd, buf, size, send_flags());
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false;
+      buf += count;
+      size -= static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  static bool read_all(int fd, char *buf, size_t size) {
+    while (size > 0) {
+      ssize_t count = read(fd, buf, size);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false;
+      buf += count;
+      size -= static_cast<size_t>(count);
+    }
+    return true;
+  }
+};
+
+/**
+ * Backend sending everything to a `GnuplotDaemon` (e.g., `gplotppd`)
+ *
+ * Commands go through the Unix socket at `path`, while datablocks are
+ * written in a `GnuplotSharedRing` of `ring_size` bytes. The daemon
+ * lends us one of its Gnuplot processes until `close()` is called.
+ * `sync` and `output_file` work as with `GnuplotProcessBackend`. Not
+ * available on Windows.
+ */
+class GnuplotDaemonBackend : public GnuplotBackend {
+public:
+  using Message = GnuplotDaemonProtocol::Message;
+
+  static const size_t DEFAULT_RING_SIZE = 4 << 20;
+
+  explicit GnuplotDaemonBackend(const std::string &path,
+                                size_t ring_size = DEFAULT_RING_SIZE) {
+    if (ring_size == 0 || !ring.create(ring_size))
+      return;
+
+    fd = GnuplotDaemonProtocol::connect_to(path);
+    if (fd < 0)
+      return;
+
+    Message type;
+    if (!GnuplotDaemonProtocol::send_message(fd, Message::HELLO, nullptr, 0,
+                                             ring.fd()) ||
+        !GnuplotDaemonProtocol::receive_message(fd, type, daemon_output_file) ||
+        type != Message::WELCOME)
+      close();
+  }
+
+  ~GnuplotDaemonBackend() override { close(); }
+
+  bool write(Channel channel, const char *buf, size_t size) override {
+    if (!ok())
+      return false;
+
+    if (channel == Channel::COMMAND) {
+      pending_commands.append(buf, size);
+      return true;
+    }
+
+    // Commands written before must reach Gnuplot first
+    if (!send_pending_commands())
+      return false;
+
+    while (size > 0) {
+      const size_t count{ring.write(buf, size)};
+      if (count > 0) {
+        const uint64_t count64{count};
+        if (!send(Message::DATA, reinterpret_cast<const char *>(&count64),
+                  sizeof(count64)))
+          return false;
+        buf += count;
+        size -= count;
+      } else if (!request(Message::DRAIN, {}, Message::DRAINED, nullptr)) {
+        // The ring is full: wait until the daemon has emptied it
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool flush() override {
+    return ok() && send_pending_commands() && send(Message::FLUSH, nullptr, 0);
+  }
+
+  [[nodiscard]] bool ok() const override { return fd >= 0; }
+
+  bool sync(int timeout_ms, std::string *output) override {
+    if (!ok() || !send_pending_commands())
+      return false;
+
+    std::string payload(sizeof(int32_t) + 1, '\0');
+    const int32_t timeout32{timeout_ms};
+    std::memcpy(&payload[0], &timeout32, sizeof(timeout32));
+    payload.back() = output ? 1 : 0;
+
+    if (!send(Message::SYNC, payload.data(), payload.size()))
+      return false;
+
+    // The output comes in pieces before the reply
+    Message received;
+    std::string reply;
+    while (GnuplotDaemonProtocol::receive_message(fd, received, reply)) {
+      if (received == Message::OUTPUT && output)
+        output->append(reply);
+      else if (received == Message::SYNC_DONE && reply.size() == 1)
+        return reply[0] != 0;
+      else
+        break;
+    }
+
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  [[nodiscard]] std::string output_file() const override {
+    return daemon_output_file;
+  }
+
+  void close() override {
+    if (fd >= 0)
+      send_pending_commands();
+
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+private:
+  bool send(Message type, const char *payload, size_t size) {
+    if (GnuplotDaemonProtocol::send_message(fd, type, payload, size))
+      return true;
+
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  bool send_pending_commands() {
+    std::string commands;
+    commands.swap(pending_commands);
+
+    // Gnuplot reads a stream, so a long command can be split anywhere
+    for (size_t start{}; start < commands.size();
+         start += GnuplotDaemonProtocol::MAX_PAYLOAD) {
+      const size_t size{std::min<size_t>(commands.size() - start,
+                                         GnuplotDaemonProtocol::MAX_PAYLOAD)};
+      if (!send(Message::COMMAND, commands.data() + start, size))
+        return false;
+    }
+    return true;
+  }
+
+  // Send a message and wait for the reply
+  bool request(Message type, const std::string &payload, Message expected,
+               std::string *reply) {
+    if (!send(type, payload.data(), payload.size()))
+      return false;
+
+    Message received;
+    std::string received_payload;
+    if (!GnuplotDaemonProtocol::receive_message(fd, received,
+                                                received_payload) ||
+        received != expected) {
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+
+    if (reply)
+      *reply = std::move(received_payload);
+    return true;
+  }
+
+  int fd{-1};
+  GnuplotSharedRing ring{};
+  std::string daemon_output_file{};
+  std::string pending_commands{};
+};
+#endif
+
+/**
+ * Resources used by a Gnuplot process (see `GnuplotResourceMonitor`)
+ */
+struct GnuplotResourceUsage {
+  // User + system CPU time, in seconds
+  double cpu_time{};
+  // Resident set size, in bytes
+  size_t rss_bytes{};
+  // Same letters as in `ps`: 'R' (running), 'S' (sleeping), 'Z'
+  // (zombie), etc.
+  char state{};
+};
+
+/**
+ * Soft limits checked by `GnuplotResourceMonitor`. Zero means "no limit"
+ */
+struct GnuplotResourceLimits {
+  size_t max_rss_bytes{};
+  double max_cpu_time{};
+};
+
+/**
+ * Sample the resources used by a Gnuplot process from /proc (Linux only)
+ *
+ * A background thread samples the process every `interval` and calls
+ * `on_limit` once each time the usage goes beyond one of the limits;
+ * the callback is armed again when the usage goes back below them.
+ * The callback runs in the background thread, and it might e.g. kill
+ * the process. The thread stops when this object is destroyed or
+ * when the process disappears.
+ */
+class GnuplotResourceMonitor {
+public:
+  using Callback = std::function<void(const GnuplotResourceUsage &)>;
+
+  GnuplotResourceMonitor(int pid, const GnuplotResourceLimits &limits,
+                         Callback on_limit,
+                         std::chrono::milliseconds interval =
+                             std::chrono::milliseconds(500))
+      : pid{pid}, limits{limits}, on_limit{std::move(on_limit)},
+        interval{interval} {
+    if (sample(pid, usage))
+      worker = std::thread{[this]() { run(); }};
+  }
+
+  ~GnuplotResourceMonitor() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+    cv.notify_all();
+    if (worker.joinable())
+      worker.join();
+  }
+
+  GnuplotResourceMonitor(const GnuplotResourceMonitor &) = delete;
+  GnuplotResourceMonitor &operator=(const GnuplotResourceMonitor &) = delete;
+
+  /* Return `true` if the process is being monitored */
+  [[nodiscard]] bool running() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return worker.joinable() && !process_gone;
+  }
+
+  /* Return the most recent sample */
+  [[nodiscard]] GnuplotResourceUsage last_usage() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return usage;
+  }
+
+  /* Read the current usage of process `pid`. Return `false` if the
+   * process does not exist or if this is not supported (non-Linux) */
+  static bool sample(int pid, GnuplotResourceUsage &result) {
+#ifdef __linux__
+    if (pid <= 0)
+      return false;
+
+    std::stringstream path;
+    path << "/proc/" << pid << "/stat";
+    FILE *file = std::fopen(path.str().c_str(), "r");
+    if (!file)
+      return false;
+
+    char buf[1024];
+    size_t count = std::fread(buf, 1, sizeof(buf) - 1, file);
+    std::fclose(file);
+    buf[count] = '\0';
+
+    // The command name (2nd field) is in parentheses and might contain
+    // spaces, so start parsing after the last ')'
+    const char *fields = std::strrchr(buf, ')');
+    if (!fields)
+      return false;
+
+    std::istringstream is{fields + 1};
+    std::string field;
+    std::vector<std::string> values;
+    while (is >> field)
+      values.push_back(field);
+
+    // Fields 3 (state), 14 (utime), 15 (stime), and 24 (rss); see proc(5)
+    if (values.size() < 22)
+      return false;
+
+    const double ticks{static_cast<double>(sysconf(_SC_CLK_TCK))};
+    result.state = values[0][0];
+    result.cpu_time =
+        (std::stod(values[11]) + std::stod(values[12])) / ticks;
+    result.rss_bytes = std::stoull(values[21]) *
+                       static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return true;
+#else
+    (void)pid;
+    (void)result;
+    return false;
+#endif
+  }
+
+private:
+  void run() {
+    bool above_limits{false};
+    std::unique_lock<std::mutex> lock{mutex};
+    while (!cv.wait_for(lock, interval, [this]() { return stopping; })) {
+      GnuplotResourceUsage current{};
+      lock.unlock();
+      bool alive = sample(pid, current) && current.state != 'Z';
+      lock.lock();
+
+      if (!alive) {
+        process_gone = true;
+        return;
+      }
+      usage = current;
+
+      bool exceeded{
+          (limits.max_rss_bytes > 0 &&
+           current.rss_bytes > limits.max_rss_bytes) ||
+          (limits.max_cpu_time > 0 && current.cpu_time > limits.max_cpu_time)};
+      if (exceeded && !above_limits && on_limit) {
+        lock.unlock();
+        on_limit(current);
+        lock.lock();
+      }
+      above_limits = exceeded;
+    }
+  }
+
+  int pid;
+  GnuplotResourceLimits limits;
+  Callback on_limit;
+  std::chrono::milliseconds interval;
+
+  mutable std::mutex mutex{};
+  std::condition_variable cv{};
+  GnuplotResourceUsage usage{};
+  bool stopping{false};
+  bool process_gone{false};
+  std::thread worker{};
+};
+
+/**
+ * Save what `Gnuplot` objects do in the Chrome `trace_event` format
+ *
+ * The file can be opened with https://ui.perfetto.dev or with
+ * chrome://tracing. Each event is a span with the name of the
+ * operation, the thread that did it, and the number of bytes involved.
+ * A tracer can be shared by many `Gnuplot` objects and threads; the
+ * file is completed when the last `std::shared_ptr` is destroyed.
+ *
+ * Use `set_global` to trace every `Gnuplot` object created afterwards,
+ * including the startup of Gnuplot, or `Gnuplot::set_tracer` to trace
+ * one object only.
+ */
+class GnuplotTracer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit GnuplotTracer(const std::string &filename)
+      : file{std::fopen(filename.c_str(), "w")}, epoch{clock::now()} {
+    if (file)
+      std::fputs("[", file);
+  }
+
+  ~GnuplotTracer() {
+    if (file) {
+      std::fputs("\n]\n", file);
+      std::fclose(file);
+    }
+  }
+
+  GnuplotTracer(const GnuplotTracer &) = delete;
+  GnuplotTracer &operator=(const GnuplotTracer &) = delete;
+
+  [[nodiscard]] bool ok() const { return file != nullptr; }
+
+  /* Save an event lasting from `start` to `end`. `name` must not
+   * contain characters that need to be escaped in JSON */
+  void add_span(const char *name, clock::time_point start,
+                clock::time_point end, size_t bytes) {
+    using us = std::chrono::duration<double, std::micro>;
+    const uint64_t tid = thread_id();
+
+    std::lock_guard<std::mutex> lock{mutex};
+    if (!file)
+      return;
+
+    std::fprintf(file,
+                 "%s\n{\"name\":\"%s\",\"cat\":\"gplotpp\",\"ph\":\"X\","
+                 "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%llu,"
+                 "\"args\":{\"bytes\":%llu}}",
+                 first_event ? "" : ",", name, us(start - epoch).count(),
+                 us(end - start).count(), process_id(),
+                 static_cast<unsigned long long>(tid),
+                 static_cast<unsigned long long>(bytes));
+    first_event = false;
+  }
+
+  /* Write the events saved so far to the file */
+  void flush() {
+    std::lock_guard<std::mutex> lock{mutex};
+    if (file)
+      std::fflush(file);
+  }
+
+  /* Measure the time between its construction and its destruction.
+   * If the tracer is null, nothing is done */
+  class Span {
+  public:
+    Span(GnuplotTracer *tracer, const char *name)
+        : tracer{tracer}, name{name} {
+      if (tracer)
+        start = clock::now();
+    }
+
+    ~Span() {
+      if (tracer)
+        tracer->add_span(name, start, clock::now(), bytes);
+    }
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+    void set_bytes(size_t new_bytes) { bytes = new_bytes; }
+
+  private:
+    GnuplotTracer *tracer;
+    const char *name;
+    clock::time_point start{};
+    size_t bytes{};
+  };
+
+  /* Trace every `Gnuplot` object created from now on (pass null to
+   * stop) */
+  static void set_global(std::shared_ptr<GnuplotTracer> tracer) {
+    std::lock_guard<std::mutex> lock{global_mutex()};
+    global_tracer() = std::move(tracer);
+  }
+
+  [[nodiscard]] static std::shared_ptr<GnuplotTracer> get_global() {
+    std::lock_guard<std::mutex> lock{global_mutex()};
+    return global_tracer();
+  }
+
+private:
+  // Small numbers are easier to read than std::thread::id hashes
+  static uint64_t thread_id() {
+    static std::atomic<uint64_t> counter{};
+    thread_local uint64_t id{++counter};
+    return id;
+  }
+
+  static unsigned long process_id() {
+#ifdef _WIN32
+    return static_cast<unsigned long>(GetCurrentProcessId());
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+  }
+
+  static std::mutex &global_mutex() {
+    static std::mutex m;
+    return m;
+  }
+
+  static std::shared_ptr<GnuplotTracer> &global_tracer() {
+    static std::shared_ptr<GnuplotTracer> tracer;
+    return tracer;
+  }
+
+  std::mutex mutex{};
+  FILE *file;
+  clock::time_point epoch;
+  bool first_event{true};
+};
+
+/**
+ * A queue of points between a real-time thread and the plotting thread
+ *
+ * All the memory is allocated (and touched) by the constructor. Then
+ * `try_push` never allocates, locks, or calls the kernel, and it
+ * completes in a bounded number of steps. If the queue is full, the
+ * point is dropped and counted (see `num_of_dropped()`). The thread
+ * that owns the `Gnuplot` object takes the points with
+ * `Gnuplot::add_points()` or `drain()`.
+ *
+ * There must be exactly one producer thread and one consumer thread.
+ */
+class GnuplotPointRing {
+public:
+  struct Point {
+    double x;
+    double y;
+  };
+
+  /* The capacity is rounded up to a power of two */
+  explicit GnuplotPointRing(size_t capacity)
+      : points(round_up(capacity)), mask{points.size() - 1} {}
+
+  GnuplotPointRing(const GnuplotPointRing &) = delete;
+  GnuplotPointRing &operator=(const GnuplotPointRing &) = delete;
+
+  /* Producer side: return `false` if the point has been dropped */
+  bool try_push(double x, double y) noexcept {
+    const size_t cur_head{head.load(std::memory_order_relaxed)};
+    if (cur_head - cached_tail > mask) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (cur_head - cached_tail > mask) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+
+    points[cur_head & mask] = Point{x, y};
+    head.store(cur_head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* Consumer side: call `consume(const Point &)` for at most
+   * `max_points` points, in the order they were pushed, and return
+   * how many they were */
+  template <typename Function>
+  size_t drain(Function consume,
+               size_t max_points = std::numeric_limits<size_t>::max()) {
+    const size_t cur_tail{tail.load(std::memory_order_relaxed)};
+    const size_t count{std::min(
+        head.load(std::memory_order_acquire) - cur_tail, max_points)};
+
+    for (size_t i{}; i < count; ++i)
+      consume(points[(cur_tail + i) & mask]);
+
+    tail.store(cur_tail + count, std::memory_order_release);
+    return count;
+  }
+
+  [[nodiscard]] size_t capacity() const { return points.size(); }
+
+  /* Number of points waiting to be drained (approximate if the other
+   * thread is running) */
+  [[nodiscard]] size_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+
+  /* Number of points that `try_push` has dropped so far */
+  [[nodiscard]] size_t num_of_dropped() const {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  static size_t round_up(size_t capacity) {
+    size_t result{1};
+    while (result < capacity)
+      result <<= 1;
+    return result;
+  }
+
+  // Producer and consumer write different cache lines
+  static const size_t CACHE_LINE = 64;
+
+  std::vector<Point> points;
+  size_t mask;
+
+  alignas(CACHE_LINE) std::atomic<size_t> head{};
+  size_t cached_tail{}; // The producer's copy of `tail`
+  std::atomic<size_t> dropped{};
+
+  alignas(CACHE_LINE) std::atomic<size_t> tail{};
+};
+
+class GnuplotPool;
+class GnuplotAnimationRenderer;
+class GnuplotAnimationBuilder;
+
+/**
+ * High-level interface to the Gnuplot executable
+ *
+ * This class establishes a connection with a new Gnuplot instance and
+ * sends commands to it through a pipe. It is able to directly plot
+ * vectors of numbers by saving them in temporary files.
+ */
+class Gnuplot {
+private:
+  friend class GnuplotPool;
+  friend class GnuplotAnimationRenderer;
+  friend class GnuplotAnimationBuilder;
+
+  /* The backend used by a `Gnuplot` object.
+   *
+   * Objects of this type can be moved but not copied. When they are
+   * destroyed, the backend is either closed or, if it was leased from
+   * a `GnuplotPool`, handed back to the pool through `on_release`. */
+  struct Connection {
+    std::unique_ptr<GnuplotBackend> backend{};
+    std::function<void(std::unique_ptr<GnuplotBackend>)> on_release{};
+
+    Connection() = default;
+    explicit Connection(std::unique_ptr<GnuplotBackend> new_backend)
+        : backend{std::move(new_backend)} {}
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    Connection(Connection &&other) noexcept { *this = std::move(other); }
+
+    Connection &operator=(Connection &&other) noexcept {
+      if (this != &other) {
+        release();
+
+        backend = std::move(other.backend);
+        on_release = std::move(other.on_release);
+        other.on_release = nullptr;
+      }
+      return *this;
+    }
+
+    ~Connection() { release(); }
+
+    [[nodiscard]] bool running() const { return backend && backend->ok(); }
+
+    // Give the backend back to its pool, or close it
+    void release() {
+      auto callback = std::move(on_release);
+      on_release = nullptr;
+
+      if (!backend)
+        return;
+
+      if (callback && backend->ok())
+        callback(std::move(backend));
+      else
+        backend->close();
+
+      backend.reset();
+    }
+  };
+
+  // Start a new Gnuplot process using the best backend available
+  static std::unique_ptr<GnuplotBackend>
+  start_gnuplot(const std::string &command,
+                const GnuplotLaunchOptions &options = {}) {
+    auto tracer = GnuplotTracer::get_global();
+    GnuplotTracer::Span span{tracer.get(), "spawn"};
+#ifdef _WIN32
+    (void)options;
+    return std::make_unique<GnuplotPipeBackend>(command);
+#else
+    if (auto zygote = GnuplotZygote::get_global())
+      return std::make_unique<GnuplotProcessBackend>(*zygote, command,
+                                                     options);
+    return std::make_unique<GnuplotProcessBackend>(command, options);
+#endif
+  }
+
+  static std::string command_line(const char *executable_name, bool persist) {
+    std::stringstream os;
+    // The --persist flag lets Gnuplot keep running after the C++
+    // program has completed its execution
+    os << executable_name;
+    if (persist)
+      os << " --persist";
+    return os.str();
+  }
+
+  // Return the name of the terminal currently used by Gnuplot, or an
+  // empty string if the backend cannot read what Gnuplot prints
+  static std::string query_terminal(GnuplotBackend &backend) {
+    const std::string file{backend.output_file()};
+    std::string output{};
+    if (file.empty() ||
+        !backend.write_command("set print '" + file +
+                               "'\nprint GPVAL_TERM\nset print") ||
+        !backend.sync(10000, &output))
+      return {};
+
+    const size_t end{output.find_last_not_of(" \r\n")};
+    return end == std::string::npos ? std::string{} : output.substr(0, end + 1);
+  }
+
+  // Commands sent to every new Gnuplot session
+  static void initialize_session(GnuplotBackend &backend) {
+    // See
+    // https://stackoverflow.com/questions/28152719/how-to-make-gnuplot-use-the-unicode-minus-sign-for-negative-numbers
+    backend.write_command("set encoding utf8\n");
+    backend.write_command("set minussign");
+  }
+
+  // Send the datablocks of a plot through the data channel
+  bool send_data(const std::string &data) {
+    GnuplotTracer::Span span{tracer.get(), "send_data"};
+    span.set_bytes(data.size());
+#ifndef _WIN32
+    GnuplotBackend::SigpipeGuard guard{};
+#endif
+    return ready_to_write() &&
+           write_to_backend(GnuplotBackend::Channel::DATA, data.data(),
+                            data.size());
+  }
+
+  // All the writes made by `Gnuplot` go through these two methods,
+  // which keep the statistics up to date
+  bool write_to_backend(GnuplotBackend::Channel channel, const char *buf,
+                        size_t size) {
+#ifndef GNUPLOTPP_DISABLE_STATS
+    StatsTimer timer{pending_stats.write_time};
+    pending_stats.bytes_written += size;
+#endif
+    // There is no backend only while `launching()`
+    if (!connection.backend) {
+      if (pending_writes.empty() || pending_writes.back().first != channel)
+        pending_writes.emplace_back(channel, std::string{});
+      pending_writes.back().second.append(buf, size);
+      return true;
+    }
+
+    return connection.backend->write(channel, buf, size);
+  }
+
+  bool flush_backend() {
+    if (!connection.backend)
+      return true;
+
+#ifndef GNUPLOTPP_DISABLE_STATS
+    StatsTimer timer{pending_stats.write_time};
+    ++pending_stats.num_of_flushes;
+#endif
+    return connection.backend->flush();
+  }
+
+  std::string escape_quotes(const std::string &s) {
+    std::string result{};
+
+    for (char c : s) {
+      if (c != '\'')
+        result.push_back(c);
+      else
+        result += "''";
+    }
+
+    return result;
+  }
+
+  std::vector<double> list_of_x;
+  std::vector<double> list_of_y;
+  std::vector<double> list_of_xerr;
+  std::vector<double> list_of_yerr;
+
+  // Points added by `PointProducer` objects. Each producer fills its
+  // own list of chunks, so that no two threads write the same memory;
+  // `drain_points` reads them and frees the chunks that are full
+  struct PointQueue {
+    struct Point {
+      double x;
+      double y;
+      uint64_t seq;
+    };
+
+    struct Chunk {
+      static const size_t CAPACITY = 1024;
+
+      std::atomic<size_t> count{};
+      std::atomic<Chunk *> next{};
+      Point points[CAPACITY];
+    };
+
+    // Where `drain_points` stopped reading the points of a producer
+    struct Cursor {
+      Chunk *chunk;
+      size_t consumed;
+    };
+
+    std::atomic<bool> by_arrival{false};
+    std::atomic<uint64_t> sequence{};
+    std::mutex mutex{};
+    std::vector<Cursor> producers{};
+
+    PointQueue() = default;
+    PointQueue(const PointQueue &) = delete;
+    PointQueue &operator=(const PointQueue &) = delete;
+
+    ~PointQueue() {
+      for (auto &cursor : producers) {
+        for (Chunk *chunk{cursor.chunk}; chunk;) {
+          Chunk *next{chunk->next.load(std::memory_order_acquire)};
+          delete chunk;
+          chunk = next;
+        }
+      }
+    }
+
+    Chunk *add_producer() {
+      auto chunk = new Chunk;
+      std::lock_guard<std::mutex> lock{mutex};
+      producers.push_back(Cursor{chunk, 0});
+      return chunk;
+    }
+
+    // Append the points published since the last call to `points`
+    void drain(std::vector<Point> &points) {
+      std::lock_guard<std::mutex> lock{mutex};
+      for (auto &cursor : producers) {
+        while (true) {
+          Chunk *chunk{cursor.chunk};
+          const size_t count{chunk->count.load(std::memory_order_acquire)};
+          points.insert(points.end(), chunk->points + cursor.consumed,
+                        chunk->points + count);
+          cursor.consumed = count;
+          if (count < Chunk::CAPACITY)
+            break;
+
+          // The producer no longer touches a chunk once it is full and
+          // the next one has been linked
+          Chunk *next{cursor.chunk->next.load(std::memory_order_acquire)};
+          if (!next)
+            break;
+          delete cursor.chunk;
+          cursor.chunk = next;
+          cursor.consumed = 0;
+        }
+      }
+    }
+  };
+
+  std::shared_ptr<PointQueue> point_queue{};
+
+  void check_consistency() const {
+    assert(list_of_x.size() == list_of_y.size());
+
+    if (list_of_xerr.size() > 0)
+      assert(list_of_xerr.size() == list_of_x.size());
+    if (list_of_yerr.size() > 0)
+      assert(list_of_yerr.size() == list_of_y.size());
+  }
+
+public:
+  enum class LineStyle {
+    DOTS,
+    LINES,
+    POINTS,
+    LINESPOINTS,
+    STEPS,
+    BOXES,
+    X_ERROR_BARS,
+    Y_ERROR_BARS,
+    XY_ERROR_BARS,
+    VECTORS,
+  };
+
+  enum class AxisScale {
+    LINEAR,
+    LOGX,
+    LOGY,
+    LOGXY,
+  };
+
+  enum class TerminalMode {
+    MONO,
+    ANSI,
+    ANSI256,
+    ANSIRGB,
+  };
+
+  enum class OutputFormat {
+    PNG,
+    SVG,
+    PDF,
+    DUMB,
+  };
+
+  /* A file where `show_to` saves the plot. If `size` is empty, the
+   * same defaults as the `redirect_to_*` methods are used */
+  struct OutputTarget {
+    OutputFormat format;
+    std::string filename;
+    std::string size{};
+  };
+
+  /* Counters describing the work done by `Gnuplot`. See `get_stats()`
+   * and `set_stats_callback()`. Times are in seconds. */
+  struct Stats {
+    size_t num_of_shows{};
+    size_t num_of_series{};
+    size_t num_of_points{};
+    size_t bytes_written{};
+    size_t num_of_flushes{};
+    // Largest amount of plot data kept in memory at the same time
+    size_t peak_buffered_bytes{};
+    // Time spent converting the data into text
+    double serialization_time{};
+    // Time spent writing to the backend, including the time spent
+    // waiting for Gnuplot to read the pipe
+    double write_time{};
+
+    Stats &operator+=(const Stats &other) {
+      num_of_shows += other.num_of_shows;
+      num_of_series += other.num_of_series;
+      num_of_points += other.num_of_points;
+      bytes_written += other.bytes_written;
+      num_of_flushes += other.num_of_flushes;
+      peak_buffered_bytes =
+          std::max(peak_buffered_bytes, other.peak_buffered_bytes);
+      serialization_time += other.serialization_time;
+      write_time += other.write_time;
+      return *this;
+    }
+  };
+
+  /* Time elapsed between calls to `show()` and the moment Gnuplot
+   * finished drawing them, in seconds (see `enable_latency_probe()`) */
+  struct Latency {
+    // Number of calls to `show()` acknowledged by Gnuplot
+    size_t count{};
+    // Calls to `show()` whose acknowledgement has not arrived yet
+    size_t pending{};
+    // Acknowledgements that never arrived (e.g., after an error)
+    size_t lost{};
+    double p50{};
+    double p99{};
+    double max{};
+  };
+
+  /* How `drain_points()` sorts the points added by `PointProducer`
+   * objects */
+  enum class PointOrder {
+    // In the order they were added, across all the threads. Every
+    // point increments a counter shared by all the producers, which
+    // is slower when many threads add points at the same time
+    ARRIVAL,
+    // By increasing X, which is usually a timestamp (the default).
+    // Points with the same X keep the order of their producer
+    TIMESTAMP,
+  };
+
+  /* A handle used by one thread to add points to a `Gnuplot` object
+   * while other threads do the same (see `make_point_producer()`).
+   * `add_point` takes no lock; it allocates memory only once every
+   * 1024 points. Each thread must use its own producer. */
+  class PointProducer {
+  public:
+    PointProducer() = default;
+
+    void add_point(double x, double y) {
+      size_t count{current->count.load(std::memory_order_relaxed)};
+      if (count == PointQueue::Chunk::CAPACITY) {
+        auto next = new PointQueue::Chunk;
+        current->next.store(next, std::memory_order_release);
+        current = next;
+        count = 0;
+      }
+
+      const uint64_t seq{
+          queue->by_arrival.load(std::memory_order_relaxed)
+              ? queue->sequence.fetch_add(1, std::memory_order_relaxed)
+              : 0};
+      current->points[count] = PointQueue::Point{x, y, seq};
+      current->count.store(count + 1, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool ok() const { return current != nullptr; }
+
+  private:
+    friend class Gnuplot;
+
+    PointProducer(std::shared_ptr<PointQueue> new_queue,
+                  PointQueue::Chunk *first)
+        : queue{std::move(new_queue)}, current{first} {}
+
+    std::shared_ptr<PointQueue> queue{};
+    PointQueue::Chunk *current{};
+  };
+
+  /* Called at the end of every `show()` with the statistics of that
+   * call and the cumulative ones */
+  using StatsCallback =
+      std::function<void(const Stats &last_show, const Stats &total)>;
+
+  Gnuplot(const char *executable_name = "gnuplot", bool persist = true)
+      : Gnuplot{executable_name, persist, GnuplotLaunchOptions{}} {}
+
+  /* Start Gnuplot with the scheduling options in `options`, e.g., to
+   * keep it away from the CPUs used by latency-critical threads. See
+   * `GnuplotLaunchOptions` */
+  Gnuplot(const char *executable_name, bool persist,
+          const GnuplotLaunchOptions &options)
+      : Gnuplot{std::unique_ptr<GnuplotBackend>{}} {
+    restart_command = command_line(executable_name, persist);
+    launch_options = options;
+
+    const std::string command{restart_command};
+    switch (options.startup) {
+    case GnuplotLaunchOptions::Startup::IMMEDIATE:
+      start_session(start_gnuplot(command, options));
+      break;
+    case GnuplotLaunchOptions::Startup::LAZY:
+      deferred_start = [command, options]() {
+        return start_gnuplot(command, options);
+      };
+      break;
+    case GnuplotLaunchOptions::Startup::BACKGROUND: {
+      auto launch = std::make_shared<BackgroundLaunch>(
+          std::async(std::launch::async, [command, options]() {
+            return start_gnuplot(command, options);
+          }));
+      background_launch = launch;
+      deferred_start = [launch]() { return launch->get(); };
+      break;
+    }
+    }
+  }
+
+  /* Send everything through `backend` instead of starting Gnuplot.
+   * See `GnuplotBackend` and its derived classes. */
+  explicit Gnuplot(std::unique_ptr<GnuplotBackend> backend)
+      : connection{std::move(backend)}, series{}, files_to_delete{},
+        is_3dplot{false} {
+    set_xrange();
+    set_yrange();
+    set_zrange();
+
+    if (ok())
+      initialize_session(*connection.backend);
+  }
+
+  /* Use a Gnuplot process leased from `pool` instead of starting a
+   * new one. The process is given back to the pool when this object
+   * is destroyed. */
+  explicit Gnuplot(GnuplotPool &pool);
+
+  Gnuplot(const Gnuplot &) = delete;
+  Gnuplot &operator=(const Gnuplot &) = delete;
+
+  /* The moved-from object is left without a session: it does not own
+   * any process, file, or pending write */
+  Gnuplot(Gnuplot &&other) noexcept = default;
+
+  /* Close the session of this object as the destructor would do, then
+   * take over the one of `other` */
+  Gnuplot &operator=(Gnuplot &&other) noexcept {
+    if (this != &other) {
+      // Reuse the destructor and the move constructor, so that no
+      // member can be forgotten here
+      this->~Gnuplot();
+      new (this) Gnuplot{std::move(other)};
+    }
+    return *this;
+  }
+
+  ~Gnuplot() { close_session(); }
+
+  /* This is the most low-level method in the Gnuplot class! It
+         returns `true` if the send command was successful, `false`
+         otherwise. */
+  bool sendcommand(const char *str) {
+    const size_t size{std::char_traits<char>::length(str)};
+    GnuplotTracer::Span span{tracer.get(), "sendcommand"};
+    span.set_bytes(size + 1);
+#ifndef _WIN32
+    // One guard for all the writes below (see `SigpipeGuard`)
+    GnuplotBackend::SigpipeGuard guard{};
+#endif
+    return ready_to_write() &&
+           write_to_backend(GnuplotBackend::Channel::COMMAND, str, size) &&
+           write_to_backend(GnuplotBackend::Channel::COMMAND, "\n", 1) &&
+           flush_backend();
+  }
+
+  bool sendcommand(const std::string &str) { return sendcommand(str.c_str()); }
+  bool sendcommand(const std::stringstream &stream) {
+    return sendcommand(stream.str());
+  }
+
+  /* Return `true` if Gnuplot is running, or if it has not been
+   * started yet (see `GnuplotLaunchOptions::Startup`) */
+  [[nodiscard]] bool ok() const {
+    return connection.running() || deferred_start != nullptr;
+  }
+
+  /* Return `true` if the Gnuplot process has been started */
+  [[nodiscard]] bool started() const { return deferred_start == nullptr; }
+
+  /* Return the backend used to talk with Gnuplot, or null (also if
+   * Gnuplot has not been started yet) */
+  [[nodiscard]] GnuplotBackend *get_backend() {
+    return connection.backend.get();
+  }
+
+  /* Wait until Gnuplot has executed all the commands sent so far.
+   *
+   * Gnuplot is asked to print a unique sentinel string, and this
+   * method blocks until the sentinel comes back. Once it returns
+   * `true`, any plot sent through `show()` has been rendered and
+   * flushed to the output file. If `timeout_ms` is negative, wait
+   * forever. Returns `false` on timeout, if Gnuplot has quit, or if
+   * the platform does not support this (Windows).
+   *
+   * Afterwards, the output of Gnuplot's `print` goes to the standard
+   * error: if you redirected it with `set print`, do it again (use
+   * `append` to avoid overwriting the file). */
+  bool sync(int timeout_ms = -1) {
+    if (!started()) {
+      // Nothing has been sent yet, so there is nothing to wait for
+      if (pending_writes.empty())
+        return true;
+      if (!ensure_running())
+        return false;
+    }
+
+    return ok() && connection.backend->sync(timeout_ms, nullptr);
+  }
+
+  /* Return the statistics accumulated since the creation of this
+   * object (or the last call to `reset_stats()`). The work done
+   * between two calls to `show()` is accounted to the second one.
+   * Everything is zero if `GNUPLOTPP_DISABLE_STATS` is defined. */
+  [[nodiscard]] const Stats &get_stats() const { return total_stats; }
+
+  /* Measure the latency of each call to `show()`: Gnuplot is asked to
+   * send back a sequence number once it has drawn the plot, and the
+   * delays are collected in a histogram (see `get_latency()`). Return
+   * `false` if the backend does not support this (only
+   * `GnuplotProcessBackend` does, thus not on Windows). Like `sync()`,
+   * this resets the target of `print` after each `show()`. */
+  bool enable_latency_probe() {
+    if (latency_probe)
+      return true;
+    if (!ensure_running())
+      return false;
+
+    auto probe = std::make_shared<LatencyProbe>();
+    if (!connection.backend->set_ack_handler(
+            [probe](uint64_t seq) { probe->acknowledge(seq); }))
+      return false;
+
+    latency_probe = std::move(probe);
+    return true;
+  }
+
+  /* Return the latencies measured since `enable_latency_probe()` */
+  [[nodiscard]] Latency get_latency() const {
+    return latency_probe ? latency_probe->summary() : Latency{};
+  }
+
+  /* Return the PID of the Gnuplot process, or -1 if unknown (e.g., on
+   * Windows, or if the backend does not start Gnuplot) */
+  [[nodiscard]] int get_pid() const {
+    return connection.backend ? connection.backend->pid() : -1;
+  }
+
+  /* Read the resources currently used by the Gnuplot process. Return
+   * `false` if this is not possible (only supported on Linux) */
+  bool get_resource_usage(GnuplotResourceUsage &usage) const {
+    return GnuplotResourceMonitor::sample(get_pid(), usage);
+  }
+
+  /* Sample the resources used by Gnuplot every `interval` in a
+   * background thread, and call `on_limit` when they go beyond `limits`
+   * (see `GnuplotResourceMonitor`). Any previous monitor is stopped.
+   * Return `false` if this is not possible (only supported on Linux) */
+  bool monitor_resources(const GnuplotResourceLimits &limits,
+                         GnuplotResourceMonitor::Callback on_limit,
+                         std::chrono::milliseconds interval =
+                             std::chrono::milliseconds(500)) {
+    // This is needed again if Gnuplot is restarted
+    start_monitor = [limits, on_limit, interval](int pid) {
+      auto monitor = std::make_unique<GnuplotResourceMonitor>(
+          pid, limits, on_limit, interval);
+      if (!monitor->running())
+        monitor.reset();
+      return monitor;
+    };
+
+    resource_monitor.reset();
+    if (ensure_running())
+      resource_monitor = start_monitor(get_pid());
+    if (!resource_monitor)
+      start_monitor = nullptr;
+    return resource_monitor != nullptr;
+  }
+
+  /* If Gnuplot quits unexpectedly, start a new process as soon as
+   * something needs to be sent, and restore the terminal, the output
+   * file, the title, the labels, the logarithmic scale, and the last
+   * plot sent by `show()`. Commands sent through `sendcommand()` are
+   * not restored. Restoring the output file opens it again, which
+   * truncates it: with terminals that put several plots in one file
+   * (e.g., PDF), only the ones drawn after the restart are kept. This
+   * only works if this object was created with the name of the Gnuplot
+   * executable. */
+  void enable_auto_restart(bool enable = true) { auto_restart = enable; }
+
+  /* Replace the Gnuplot process with a new one, restoring the state
+   * as described in `enable_auto_restart()` */
+  bool restart() {
+    if (restart_command.empty() || restarting)
+      return false;
+
+    restarting = true;
+    GnuplotTracer::Span span{tracer.get(), "restart"};
+
+    if (connection.backend)
+      connection.backend->set_ack_handler(nullptr);
+    resource_monitor.reset();
+    deferred_start = nullptr;
+    // The state is sent again anyway
+    background_launch.reset();
+    pending_writes.clear();
+    stale_output = false;
+    ++num_of_restarts;
+
+    const bool result{
+        start_session(start_gnuplot(restart_command, launch_options))};
+
+    restarting = false;
+    return result;
+  }
+
+  /* Return how many times Gnuplot has been restarted */
+  [[nodiscard]] size_t get_num_of_restarts() const { return num_of_restarts; }
+
+  /* Return the monitor started by `monitor_resources()`, or null */
+  [[nodiscard]] const GnuplotResourceMonitor *get_resource_monitor() const {
+    return resource_monitor.get();
+  }
+
+  /* Save trace events in `new_tracer` (see `GnuplotTracer`); pass null
+   * to stop. By default, the global tracer is used */
+  void set_tracer(std::shared_ptr<GnuplotTracer> new_tracer) {
+    tracer = std::move(new_tracer);
+  }
+
+  /* Return the statistics of the last call to `show()` */
+  [[nodiscard]] const Stats &get_last_show_stats() const {
+    return last_show_stats;
+  }
+
+  void reset_stats() {
+    pending_stats = last_show_stats = total_stats = {};
+    buffered_bytes = 0;
+  }
+
+  void set_stats_callback(StatsCallback callback) {
+    stats_callback = std::move(callback);
+  }
+
+  /* Save the plot to a PNG file instead of displaying a window */
+  bool redirect_to_png(const std::string &filename,
+                       const std::string &size = "800,600") {
+    std::stringstream os;
+
+    os << terminal_command(OutputFormat::PNG, size) << "\n"
+       << "set output '" << filename << "'\n";
+    return send_state("output", os.str());
+  }
+
+  /* Save the plot to a PDF file instead of displaying a window */
+  bool redirect_to_pdf(const std::string &filename,
+                       std::string size = "16cm,12cm") {
+    std::stringstream os;
+
+    os << terminal_command(OutputFormat::PDF, size) << "\n"
+       << "set output '" << filename << "'\n";
+    return send_state("output", os.str());
+  }
+
+  /* Save the plot to a SVG file instead of displaying a window */
+  bool redirect_to_svg(const std::string &filename,
+                       const std::string &size = "800,600") {
+    std::stringstream os;
+
+    os << terminal_command(OutputFormat::SVG, size) << "\n"
+       << "set output '" << filename << "'\n";
+    return send_state("output", os.str());
+  }
+
+  /* Save the plot to an animated GIF. The delay between frames is specified
+   * by the `delay_ms` parameter (in milliseconds). If `loop` is `true` (the
+   * default), the animation will loop indefinitely, otherwise it will just
+   * play once and stop at the last frame.
+   *
+   * Note that frames are saved only once you call `Gnuplot::show()`. Therefore,
+   * if you want to put N frames in your animation, you have to call
+   * `Gnuplot::show()` exactly N times.
+   */
+  bool redirect_to_animated_gif(const std::string &filename,
+                                const std::string &size = "800,600",
+                                int delay_ms = 50, bool loop = true) {
+    std::stringstream os;
+
+    // Unfortunately, Gnuplot requires the delay to be expressed in units of
+    // 1/100 s instead of the more common unit 1/1000 s, so we need to divide
+    // by 10. We do not support a fixed number of repetitions: either you loop
+    // infinitely or play the animation just once
+    os << "set terminal gif animate delay " << delay_ms / 10 << " loop "
+	<< (loop ? 0 : 1) << " size " << size << "\n"
+       << "set output '" << filename << "'\n";
+    return send_state("output", os.str());
+  }
+
+  /* Send the plot to the terminal or to a text file */
+  bool redirect_to_dumb(const std::string &filename = "",
+                        unsigned int width = 80, unsigned int height = 50,
+                        TerminalMode mode = TerminalMode::MONO) {
+    std::stringstream os;
+
+    os << "set terminal dumb size " << width << " " << height << " ";
+
+    switch (mode) {
+    case TerminalMode::MONO:
+      os << "mono";
+      break;
+    case TerminalMode::ANSI:
+      os << "ansi";
+      break;
+    case TerminalMode::ANSI256:
+      os << "ansi256";
+      break;
+    case TerminalMode::ANSIRGB:
+      os << "ansirgb";
+      break;
+    default:
+      os << "mono";
+    }
+
+    os << "\n";
+
+    if (!filename.empty()) {
+      os << "set output '" << filename << "'\n";
+    }
+
+    return send_state("output", os.str());
+  }
+
+  /* Render the series created by the `plot` commands and store the
+   * image in `buffer`, without using any file. This works like
+   * `show()`, and once it returns `true` the image is complete.
+   *
+   * If `size` is empty, the same defaults as `redirect_to_png`,
+   * `redirect_to_svg`, `redirect_to_pdf`, and `redirect_to_dumb` are
+   * used. Afterwards the terminal used before the call is restored,
+   * but the output is reset: if you were saving plots to a file, you
+   * must call `redirect_to_*` again. This requires a backend that
+   * supports `GnuplotBackend::output_file`, like the default one on
+   * Linux and Mac OS X (but not on Windows).
+   *
+   * Return `false` if the image is not complete within `timeout_ms`
+   * milliseconds (wait forever if negative). The commands restoring the
+   * terminal have already been sent, so Gnuplot restores it as soon as
+   * it is done; whatever it writes afterwards is discarded by the next
+   * call. */
+  bool render_to_buffer(std::string &buffer, OutputFormat format,
+                        const std::string &size = "",
+                        int timeout_ms = 10000) {
+    buffer.clear();
+
+    if (series.empty() || !ensure_running())
+      return false;
+
+    std::string output_file{connection.backend->output_file()};
+    if (output_file.empty())
+      return false;
+
+    if (stale_output) {
+      // The image of a call that timed out might still be coming
+      std::string stale{};
+      if (!connection.backend->sync(timeout_ms, &stale))
+        return false;
+      stale_output = false;
+    }
+
+    // Closing the output forces Gnuplot to complete the file
+    if (!begin_temporary_output(terminal_command(format, size),
+                                output_file) ||
+        !show() || !end_temporary_output())
+      return false;
+
+    if (!connection.backend->sync(timeout_ms, &buffer)) {
+      buffer.clear();
+      stale_output = true;
+      return false;
+    }
+    return true;
+  }
+
+  /* Save the series created by the `plot` commands in several files,
+   * e.g., a PNG and a PDF version of the same plot. The data are sent
+   * to Gnuplot only once: for each file after the first one, only the
+   * terminal and the output are changed before a `replot`.
+   *
+   * The terminal used before the call is restored afterwards, but the
+   * output is reset, as in `render_to_buffer`. */
+  bool show_to(const std::vector<OutputTarget> &targets) {
+    if (targets.empty() || series.empty())
+      return false;
+
+    bool result =
+        begin_temporary_output(
+            terminal_command(targets[0].format, targets[0].size),
+            escape_quotes(targets[0].filename)) &&
+        show();
+
+    for (size_t i{1}; result && i < targets.size(); ++i) {
+      const OutputTarget &target = targets[i];
+      std::stringstream replot;
+      replot << terminal_command(target.format, target.size) << "\n"
+             << "set output '" << escape_quotes(target.filename) << "'\n"
+             << "replot";
+      result = sendcommand(replot);
+    }
+
+    // Closing the output forces Gnuplot to complete the last file
+    return end_temporary_output() && result;
+  }
+
+  bool set_title(const std::string &title) {
+    std::stringstream os;
+    os << "set title '" << escape_quotes(title) << "'";
+    return send_state("title", os.str());
+  }
+
+  /* Set the label on the X axis */
+  bool set_xlabel(const std::string &label) {
+    std::stringstream os;
+    os << "set xlabel '" << escape_quotes(label) << "'";
+    return send_state("xlabel", os.str());
+  }
+
+  /* Set the label on the Y axis */
+  bool set_ylabel(const std::string &label) {
+    std::stringstream os;
+    os << "set ylabel '" << escape_quotes(label) << "'";
+    return send_state("ylabel", os.str());
+  }
+
+  /* Set the minimum and maximum value to be displayed along the X axis */
+  void set_xrange(double min = NAN, double max = NAN) {
+    xrange = format_range(min, max);
+  }
+
+  /* Set the minimum and maximum value to be displayed along the X axis */
+  void set_yrange(double min = NAN, double max = NAN) {
+    yrange = format_range(min, max);
+  }
+
+  /* Set the minimum and maximum value to be displayed along the X axis */
+  void set_zrange(double min = NAN, double max = NAN) {
+    zrange = format_range(min, max);
+  }
+
+  bool set_logscale(AxisScale scale) {
+    switch (scale) {
+    case AxisScale::LOGX:
+      return send_state("logscale", "set logscale x");
+    case AxisScale::LOGY:
+      return send_state("logscale", "set logscale y");
+    case AxisScale::LOGXY:
+      return send_state("logscale", "set logscale xy");
+    default:
+      return send_state("logscale", "unset logscale");
+    }
+  }
+
+  template <typename T>
+  void plot(const std::vector<T> &y, const std::string &label = "",
+            LineStyle style = LineStyle::LINES) {
+    _plot(label, style, false, y);
+  }
+
+  template <typename T, typename U>
+  void plot(const std::vector<T> &x, const std::vector<U> &y,
+            const std::string &label = "", LineStyle style = LineStyle::LINES) {
+    _plot(label, style, false, x, y);
   }
 
   template <typename T, typename U, typename V>
@@ -383,334 +3579,2138 @@ public:
     _plot(label, LineStyle::X_ERROR_BARS, false, x, y, err);
   }
 
-  template <typename T, typename U, typename V>
-  void plot_yerr(const std::vector<T> &x, const std::vector<U> &y,
-                 const std::vector<V> &err, const std::string &label = "") {
-    _plot(label, LineStyle::Y_ERROR_BARS, false, x, y, err);
+  template <typename T, typename U, typename V>
+  void plot_yerr(const std::vector<T> &x, const std::vector<U> &y,
+                 const std::vector<V> &err, const std::string &label = "") {
+    _plot(label, LineStyle::Y_ERROR_BARS, false, x, y, err);
+  }
+
+  template <typename T, typename U, typename V, typename W>
+  void plot_xyerr(const std::vector<T> &x, const std::vector<U> &y,
+                  const std::vector<V> &xerr, const std::vector<W> &yerr,
+                  const std::string &label = "") {
+    _plot(label, LineStyle::XY_ERROR_BARS, false, x, y, xerr, yerr);
+  }
+
+  template <typename T, typename U, typename V, typename W>
+  void plot_vectors(const std::vector<T> &x, const std::vector<U> &y,
+                    const std::vector<V> &vx, const std::vector<W> &vy,
+                    const std::string &label = "") {
+    _plot(label, LineStyle::VECTORS, false, x, y, vx, vy);
+  }
+
+  template <typename T, typename U>
+  void plot3d(const std::vector<T> &x, const std::vector<U> &y,
+              const std::vector<U> &z, const std::string &label = "",
+              LineStyle style = LineStyle::LINES) {
+    _plot(label, style, true, x, y, z);
+  }
+
+  template <typename T, typename U, typename V, typename W>
+  void plot_vectors3d(const std::vector<T> &x, const std::vector<U> &y,
+                      const std::vector<T> &z, const std::vector<V> &vx,
+                      const std::vector<W> &vy, const std::vector<T> &vz,
+                      const std::string &label = "") {
+    _plot(label, LineStyle::VECTORS, true, x, y, z, vx, vy, vz);
+  }
+
+  /* Add a point and a X error bar to the list of samples to be plotted */
+  void add_point_xerr(double x, double y, double err) {
+    check_consistency();
+
+    list_of_x.push_back(x);
+    list_of_y.push_back(y);
+    list_of_xerr.push_back(err);
+  }
+
+  /* Add a point and a Y error bar to the list of samples to be plotted */
+  void add_point_yerr(double x, double y, double err) {
+    check_consistency();
+
+    list_of_x.push_back(x);
+    list_of_y.push_back(y);
+    list_of_yerr.push_back(err);
+  }
+
+  /* Add a point and two X/Y error bars to the list of samples to be plotted */
+  void add_point_xyerr(double x, double y, double xerr, double yerr) {
+    check_consistency();
+
+    list_of_x.push_back(x);
+    list_of_y.push_back(y);
+    list_of_xerr.push_back(xerr);
+    list_of_yerr.push_back(yerr);
+  }
+  /* Add a point to the list of samples to be plotted */
+  void add_point(double x, double y) {
+    check_consistency();
+
+    list_of_x.push_back(x);
+    list_of_y.push_back(y);
+  }
+
+  /* Add a value to the list of samples to be plotted */
+  void add_point(double y) {
+    add_point(static_cast<double>(list_of_x.size()), y);
+  }
+
+  /* Return a handle that lets another thread add points, to be
+   * plotted by `plot(label, style)` like those added by `add_point`.
+   * The object can be moved to the thread and may outlive this one. */
+  [[nodiscard]] PointProducer make_point_producer() {
+    if (!point_queue)
+      point_queue = std::make_shared<PointQueue>();
+    return PointProducer{point_queue, point_queue->add_producer()};
+  }
+
+  /* Choose how `drain_points()` sorts the points (by default,
+   * `PointOrder::TIMESTAMP`). Call this before `make_point_producer()` */
+  void set_point_order(PointOrder order) {
+    if (!point_queue)
+      point_queue = std::make_shared<PointQueue>();
+    point_queue->by_arrival = order == PointOrder::ARRIVAL;
+  }
+
+  /* Move the points added so far by `PointProducer` objects into the
+   * list used by `add_point`, and return how many they were. This is
+   * called by `plot(label, style)`. Points that another thread is
+   * adding right now might be left for the next call, so the order is
+   * guaranteed only within the points moved by each call. */
+  size_t drain_points() {
+    if (!point_queue)
+      return 0;
+
+    std::vector<PointQueue::Point> points{};
+    point_queue->drain(points);
+
+    using Point = PointQueue::Point;
+    if (point_queue->by_arrival)
+      std::sort(points.begin(), points.end(),
+                [](const Point &a, const Point &b) { return a.seq < b.seq; });
+    else
+      std::stable_sort(
+          points.begin(), points.end(),
+          [](const Point &a, const Point &b) { return a.x < b.x; });
+
+    list_of_x.reserve(list_of_x.size() + points.size());
+    list_of_y.reserve(list_of_y.size() + points.size());
+    for (const auto &point : points) {
+      list_of_x.push_back(point.x);
+      list_of_y.push_back(point.y);
+    }
+    return points.size();
+  }
+
+  /* Move at most `max_points` points from `ring` into the list used
+   * by `add_point`, and return how many they were. Call this from the
+   * thread that consumes `ring` */
+  size_t add_points(GnuplotPointRing &ring,
+                    size_t max_points = std::numeric_limits<size_t>::max()) {
+    check_consistency();
+
+    const size_t count{std::min(ring.size(), max_points)};
+    list_of_x.reserve(list_of_x.size() + count);
+    list_of_y.reserve(list_of_y.size() + count);
+    return ring.drain(
+        [this](const GnuplotPointRing::Point &point) {
+          list_of_x.push_back(point.x);
+          list_of_y.push_back(point.y);
+        },
+        max_points);
+  }
+
+  /* Return the number of points added by `add_point` */
+  [[nodiscard]] int get_num_of_points() const {
+    check_consistency();
+
+    return (int)list_of_x.size();
+  }
+
+  /* Return the list of abscissas for the points added by `add_point` */
+  [[nodiscard]] const std::vector<double> &get_points_x() const {
+    return list_of_x;
+  }
+
+  /* Return the list of ordinates for the points added by `add_point` */
+  [[nodiscard]] const std::vector<double> &get_points_y() const {
+    return list_of_y;
+  }
+
+  /* Create a plot using the values set with the method `add_point`
+   * and by `PointProducer` objects */
+  void plot(const std::string &label = "", LineStyle style = LineStyle::LINES) {
+    drain_points();
+    check_consistency();
+
+    _plot(label, style, false, list_of_x, list_of_y);
+  }
+
+  /* Create a plot with X error bars using the values set with the method
+   * `add_point` */
+  void plot_xerr(const std::string &label = "") {
+    check_consistency();
+
+    plot_xerr(list_of_x, list_of_y, list_of_xerr, label);
+  }
+
+  /* Create a plot with X error bars using the values set with the method
+   * `add_point` */
+  void plot_yerr(const std::string &label = "") {
+    check_consistency();
+
+    plot_yerr(list_of_x, list_of_y, list_of_yerr, label);
+  }
+
+  /* Create a plot with X error bars using the values set with the method
+   * `add_point` */
+  void plot_xyerr(const std::string &label = "") {
+    check_consistency();
+
+    plot_xyerr(list_of_x, list_of_y, list_of_xerr, list_of_yerr, label);
+  }
+
+  template <typename T>
+  void histogram(const std::vector<T> &values, size_t nbins,
+                 const std::string &label = "",
+                 LineStyle style = LineStyle::BOXES) {
+    assert(nbins > 0);
+
+    if (values.empty())
+      return;
+
+    if (!series.empty()) {
+      assert(!is_3dplot);
+    }
+
+    GnuplotTracer::Span span{tracer.get(), "histogram"};
+#ifndef GNUPLOTPP_DISABLE_STATS
+    StatsTimer timer{pending_stats.serialization_time};
+#endif
+    auto min_iter = std::min_element(values.begin(), values.end());
+    auto max_iter = std::max_element(values.begin(), values.end());
+    double min, max, binwidth;
+
+    std::vector<size_t> bins{};
+
+    // Check if all the elements are the same
+    if (min_iter != max_iter) {
+      min = *min_iter;
+      max = *max_iter;
+      binwidth = (max - min) / nbins;
+
+      bins.resize(nbins);
+      for (const auto &val : values) {
+        int index = static_cast<int>((val - min) / binwidth);
+        if (index >= int(nbins))
+          --index;
+
+        bins.at(index)++;
+      }
+    } else {
+      // Just one bin…
+
+      min = max = *min_iter;
+      binwidth = 1.0;
+      nbins = 1;
+      bins.push_back(static_cast<double>(values.size()));
+    }
+
+    std::stringstream of;
+    for (size_t i{}; i < nbins; ++i) {
+      of << min + binwidth * (i + 0.5) << " " << bins[i] << "\n";
+    }
+
+    series.push_back(GnuplotSeries{of.str(), style, label, "1:2", nbins});
+    span.set_bytes(series.back().data_string.size());
+    is_3dplot = false;
+  }
+
+  // Ask Gnuplot to use a multiple-plot layout
+  bool multiplot(int nrows, int ncols, const std::string &title = "") {
+    std::stringstream os;
+    os << "set multiplot layout " << nrows << ", " << ncols << " title '"
+       << escape_quotes(title) << "'\n";
+    return sendcommand(os);
+  }
+
+  // Force Gnuplot to draw all the series sent through any of the `plot`
+  // commands
+  bool show(bool call_reset = true) {
+    if (series.empty())
+      return true;
+
+    const auto submitted = std::chrono::steady_clock::now();
+    std::string data_string, commands;
+    {
+      GnuplotTracer::Span span{tracer.get(), "show"};
+#ifndef GNUPLOTPP_DISABLE_STATS
+      StatsTimer timer{pending_stats.serialization_time};
+#endif
+      // Write the data in separate series
+      std::stringstream data;
+      for (size_t i{}; i < series.size(); ++i) {
+        const GnuplotSeries &s = series.at(i);
+        data << "$Datablock" << i << " << EOD\n"
+             << s.data_string << "\nEOD\n";
+      }
+
+      std::stringstream os;
+      os << "set style fill solid 0.5\n";
+      write_plot_command(os, series, is_3dplot, "$Datablock", "", xrange,
+                         yrange, zrange);
+
+      data_string = data.str();
+      commands = os.str();
+      span.set_bytes(data_string.size() + commands.size());
+    }
+
+    update_stats(series, data_string.size() + commands.size());
+    bool result = send_plot(data_string, commands);
+    finish_show_stats();
+    if (result)
+      request_ack(submitted);
+
+    if (result && call_reset)
+      reset();
+
+    return result;
+  }
+
+  /* Store the series created by the `plot` commands as a new frame of
+   * an animation, without sending anything to Gnuplot, and start
+   * with a blank plot. Once all the frames are ready, call
+   * `show_frames()`. */
+  void next_frame() {
+    if (series.empty())
+      return;
+
+    if (!frames.empty()) {
+      // All the frames must contain the same kind of series
+      assert(frames[0].is_3dplot == is_3dplot);
+      assert(frames[0].series.size() == series.size());
+    }
+
+    frames.push_back(
+        GnuplotFrame{std::move(series), xrange, yrange, zrange, is_3dplot});
+    series = {};
+    reset();
+  }
+
+  /* Return the number of frames stored by `next_frame()` */
+  [[nodiscard]] size_t get_num_of_frames() const { return frames.size(); }
+
+  /* Send all the frames stored by `next_frame()` to Gnuplot at once.
+   *
+   * The data of each series is sent in one datablock, where frames are
+   * separated by two blank lines, and a single `do for` loop plots
+   * them using `index`. This is much faster than calling `show()` for
+   * each frame. The styles, titles, and ranges of the first frame are
+   * used for the whole animation. */
+  bool show_frames() {
+    if (frames.empty())
+      return true;
+
+    const auto submitted = std::chrono::steady_clock::now();
+    const GnuplotFrame &first = frames.front();
+
+    std::string data_string, commands;
+    {
+      GnuplotTracer::Span span{tracer.get(), "show_frames"};
+#ifndef GNUPLOTPP_DISABLE_STATS
+      StatsTimer timer{pending_stats.serialization_time};
+#endif
+      std::stringstream data;
+      for (size_t i{}; i < first.series.size(); ++i) {
+        data << "$Frames" << i << " << EOD\n";
+        for (const auto &frame : frames)
+          data << frame.series.at(i).data_string << "\n\n";
+        data << "EOD\n";
+      }
+
+      std::stringstream os;
+      os << "set style fill solid 0.5\n";
+      os << "do for [gplotpp_frame=0:" << frames.size() - 1 << "] { ";
+      write_plot_command(os, first.series, first.is_3dplot, "$Frames",
+                         " index gplotpp_frame", first.xrange, first.yrange,
+                         first.zrange);
+      os << " }";
+
+      data_string = data.str();
+      commands = os.str();
+      span.set_bytes(data_string.size() + commands.size());
+    }
+
+    for (const auto &frame : frames)
+      update_stats(frame.series, 0);
+    update_stats({}, data_string.size() + commands.size());
+
+    frames.clear();
+    bool result = send_plot(data_string, commands);
+    finish_show_stats();
+    if (result)
+      request_ack(submitted);
+    return result;
+  }
+
+  // Remove all the series from memory and start with a blank plot
+  void reset() {
+    series.clear();
+    set_xrange();
+    set_yrange();
+    is_3dplot = false;
+  }
+
+private:
+  void _print_ith_elements(std::ostream &, std::ostream &, int, size_t) {}
+
+  template <typename T, typename... Args>
+  void _print_ith_elements(std::ostream &os, std::ostream &fmts, int index,
+                           size_t i, const std::vector<T> &v,
+                           const Args &...args) {
+    os << v[i] << " ";
+
+    if (i == 0) {
+      if (index > 1)
+        fmts << ':';
+      fmts << index;
+    }
+
+    _print_ith_elements(os, fmts, index + 1, i, args...);
+  }
+
+  template <typename T, typename... Args>
+  void _plot(const std::string &label, LineStyle style, bool is_this_3dplot,
+             const std::vector<T> &v, const Args &...args) {
+    if (v.empty())
+      return;
+
+    if (!series.empty()) {
+      // Check that we are not adding a 3D plot to a 2D plot, or vice versa
+      assert(is_3dplot == is_this_3dplot);
+    }
+
+    GnuplotTracer::Span span{tracer.get(), "plot"};
+#ifndef GNUPLOTPP_DISABLE_STATS
+    StatsTimer timer{pending_stats.serialization_time};
+#endif
+    std::stringstream of;
+    std::stringstream fmtstring;
+    for (size_t i{}; i < v.size(); ++i) {
+      _print_ith_elements(of, fmtstring, 1, i, v, args...);
+      of << "\n";
+    }
+
+    series.push_back(GnuplotSeries{of.str(), style, label, fmtstring.str(),
+                                   v.size()});
+    span.set_bytes(series.back().data_string.size());
+    is_3dplot = is_this_3dplot;
+  }
+
+  struct GnuplotSeries {
+    std::string data_string;
+    LineStyle line_style;
+    std::string title;
+    std::string column_range;
+    size_t num_of_points;
+  };
+
+  // Give the Gnuplot process back to its pool or close it, and remove
+  // the data files. Used by the destructor and the move assignment
+  void close_session() {
+    // Deliver what was written while Gnuplot was starting
+    if (!pending_writes.empty())
+      ensure_running();
+
+    resource_monitor.reset();
+
+    // The handler must not outlive us if the backend goes back to a pool
+    if (latency_probe && connection.backend)
+      connection.backend->set_ack_handler(nullptr);
+
+    if (connection.backend) {
+      // Bye bye, Gnuplot! (Or see you later, if we come from a pool)
+      GnuplotTracer::Span span{tracer.get(), "close"};
+      connection.release();
+    }
+
+    // Now remove the data files
+    for (const auto &fname : files_to_delete) {
+      std::remove(fname.c_str());
+    }
+    files_to_delete.clear();
+  }
+
+#ifndef GNUPLOTPP_DISABLE_STATS
+  // Add the time elapsed during the lifetime of this object to `seconds`
+  class StatsTimer {
+  public:
+    explicit StatsTimer(double &seconds)
+        : seconds{seconds}, start{std::chrono::steady_clock::now()} {}
+    ~StatsTimer() {
+      seconds += std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+    }
+
+  private:
+    double &seconds;
+    std::chrono::steady_clock::time_point start;
+  };
+#endif
+
+  // Keeps track of the acknowledgements requested by `show()`. It is
+  // shared with the handler installed in the backend
+  class LatencyProbe {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    uint64_t submit(clock::time_point submitted) {
+      std::lock_guard<std::mutex> lock{mutex};
+      pending[++last_seq] = submitted;
+      return last_seq;
+    }
+
+    void forget(uint64_t seq) {
+      std::lock_guard<std::mutex> lock{mutex};
+      pending.erase(seq);
+    }
+
+    void acknowledge(uint64_t seq) {
+      const auto now = clock::now();
+      std::lock_guard<std::mutex> lock{mutex};
+
+      auto it = pending.find(seq);
+      if (it == pending.end())
+        return;
+
+      const double delay{
+          std::chrono::duration<double>(now - it->second).count()};
+      ++buckets[bucket(delay)];
+      ++count;
+      max = std::max(max, delay);
+
+      // Acknowledgements arrive in order: the older ones are lost
+      lost += static_cast<size_t>(std::distance(pending.begin(), it));
+      pending.erase(pending.begin(), std::next(it));
+    }
+
+    Latency summary() const {
+      std::lock_guard<std::mutex> lock{mutex};
+      return Latency{count,         pending.size(), lost,
+                     quantile(0.5), quantile(0.99), max};
+    }
+
+  private:
+    // Logarithmic buckets starting from 1 µs, with a resolution of ~9%
+    static const int BUCKETS_PER_OCTAVE = 8;
+    static const int NUM_OF_BUCKETS = 40 * BUCKETS_PER_OCTAVE;
+
+    static size_t bucket(double seconds) {
+      const double us{seconds * 1e6};
+      if (us <= 1.0)
+        return 0;
+      const auto index =
+          static_cast<size_t>(std::log2(us) * BUCKETS_PER_OCTAVE);
+      return std::min(index, static_cast<size_t>(NUM_OF_BUCKETS - 1));
+    }
+
+    // Return the upper bound of the bucket containing the quantile
+    double quantile(double q) const {
+      if (count == 0)
+        return 0.0;
+
+      const auto target = static_cast<size_t>(std::ceil(q * count));
+      size_t cumulative{};
+      for (size_t i{}; i < buckets.size(); ++i) {
+        cumulative += buckets[i];
+        if (cumulative >= target) {
+          const double upper{
+              std::exp2(static_cast<double>(i + 1) / BUCKETS_PER_OCTAVE) *
+              1e-6};
+          return std::min(upper, max);
+        }
+      }
+      return max;
+    }
+
+    mutable std::mutex mutex{};
+    std::map<uint64_t, clock::time_point> pending{};
+    uint64_t last_seq{};
+    std::vector<size_t> buckets = std::vector<size_t>(NUM_OF_BUCKETS);
+    size_t count{};
+    size_t lost{};
+    double max{};
+  };
+
+  // Start Gnuplot if it has not been started yet, or again if it has
+  // quit and `auto_restart` is set
+  bool ensure_running() {
+    if (!started()) {
+      // A background launch is waited for here. Everything sent in the
+      // meantime, including the state, is in `pending_writes`
+      auto launch = std::move(deferred_start);
+      deferred_start = nullptr;
+      const bool replay_state{background_launch == nullptr};
+      background_launch.reset();
+      return start_session(launch(), replay_state);
+    }
+
+    return ok() || (auto_restart && !restarting && restart());
+  }
+
+  // Return `true` if Gnuplot is being started in the background and
+  // is not ready yet
+  [[nodiscard]] bool launching() const {
+    return deferred_start && background_launch &&
+           background_launch->wait_for(std::chrono::seconds(0)) !=
+               std::future_status::ready;
+  }
+
+  // Like `ensure_running`, but do not wait for a background launch:
+  // until it completes, writes go to `pending_writes`
+  bool ready_to_write() { return launching() || ensure_running(); }
+
+  // Talk with Gnuplot through `backend` from now on, and send the
+  // state of the session and the last plot (if any, and if
+  // `replay_state` is set), then whatever is in `pending_writes`
+  bool start_session(std::unique_ptr<GnuplotBackend> backend,
+                     bool replay_state = true) {
+    const bool was_restarting{restarting};
+    restarting = true;
+
+    connection = Connection{std::move(backend)};
+    bool result{connection.running()};
+    if (result) {
+      initialize_session(*connection.backend);
+
+      if (latency_probe) {
+        auto probe = latency_probe;
+        connection.backend->set_ack_handler(
+            [probe](uint64_t seq) { probe->acknowledge(seq); });
+      }
+
+      if (replay_state) {
+        for (const auto &entry : session_state)
+          result = result && sendcommand(entry.second);
+
+        if (!last_plot_commands.empty())
+          result = result && send_data(last_plot_data) &&
+                   sendcommand(last_plot_commands);
+      }
+
+      for (const auto &write : pending_writes)
+        result = result && write_to_backend(write.first, write.second.data(),
+                                            write.second.size());
+      result = result && flush_backend();
+
+      if (start_monitor)
+        resource_monitor = start_monitor(get_pid());
+    }
+
+    pending_writes.clear();
+    restarting = was_restarting;
+    return result;
+  }
+
+  // Send a command that changes the state of the session, remembering
+  // it as `key` so that `restart` can send it again
+  bool send_state(const std::string &key, const std::string &command) {
+    auto it = std::find_if(
+        session_state.begin(), session_state.end(),
+        [&key](const std::pair<std::string, std::string> &entry) {
+          return entry.first == key;
+        });
+    if (it != session_state.end())
+      it->second = command;
+    else
+      session_state.emplace_back(key, command);
+
+    // This is sent by `start_session` once Gnuplot is started, unless
+    // it is being started in the background: then it must be kept in
+    // order with the other commands
+    if (!started() && !background_launch)
+      return true;
+
+    // If Gnuplot quits while we are writing, `restart` sends the
+    // command again
+    return sendcommand(command) ||
+           (auto_restart && !restarting && restart());
+  }
+
+  // Send the datablocks and the commands of a plot. If needed, they
+  // are kept in memory so that `restart` can send them again
+  bool send_plot(const std::string &data, const std::string &commands) {
+#ifndef _WIN32
+    GnuplotBackend::SigpipeGuard guard{};
+#endif
+    if (!ready_to_write())
+      return false;
+
+    if (auto_restart) {
+      last_plot_data = data;
+      last_plot_commands = commands;
+    }
+
+    return (send_data(data) && sendcommand(commands)) ||
+           (auto_restart && !restarting && restart());
+  }
+
+  // Send a plot serialized by another `Gnuplot` object, accounting for
+  // it as a call to `show()` (see `GnuplotAnimationBuilder`)
+  bool show_serialized(const std::string &data, const std::string &commands,
+                       size_t num_of_series, size_t num_of_points) {
+    const auto submitted = std::chrono::steady_clock::now();
+#ifndef GNUPLOTPP_DISABLE_STATS
+    pending_stats.num_of_series += num_of_series;
+    pending_stats.num_of_points += num_of_points;
+#else
+    (void)num_of_series;
+    (void)num_of_points;
+#endif
+    update_stats({}, data.size() + commands.size());
+
+    bool result = send_plot(data, commands);
+    finish_show_stats();
+    if (result)
+      request_ack(submitted);
+    return result;
+  }
+
+  // Ask the backend to acknowledge a plot submitted at `submitted`
+  void request_ack(std::chrono::steady_clock::time_point submitted) {
+    if (!latency_probe || !connection.running())
+      return;
+
+    const uint64_t seq{latency_probe->submit(submitted)};
+    if (!connection.backend->request_ack(seq))
+      latency_probe->forget(seq);
+  }
+
+  // Account for `list_of_series`, which is about to be sent together
+  // with `extra_bytes` bytes of commands and datablocks. It can be
+  // called several times before `finish_show_stats()`
+  void update_stats(const std::vector<GnuplotSeries> &list_of_series,
+                    size_t extra_bytes) {
+#ifndef GNUPLOTPP_DISABLE_STATS
+    buffered_bytes += extra_bytes;
+    for (const auto &s : list_of_series) {
+      ++pending_stats.num_of_series;
+      pending_stats.num_of_points += s.num_of_points;
+      buffered_bytes += s.data_string.size();
+    }
+    pending_stats.peak_buffered_bytes =
+        std::max(pending_stats.peak_buffered_bytes, buffered_bytes);
+#else
+    (void)list_of_series;
+    (void)extra_bytes;
+#endif
+  }
+
+  // Close the statistics of a call to `show()` and notify the callback
+  void finish_show_stats() {
+#ifndef GNUPLOTPP_DISABLE_STATS
+    pending_stats.num_of_shows = 1;
+    total_stats += pending_stats;
+    last_show_stats = pending_stats;
+    pending_stats = {};
+    buffered_bytes = 0;
+
+    if (stats_callback)
+      stats_callback(last_show_stats, total_stats);
+#endif
+  }
+
+  struct GnuplotFrame {
+    std::vector<GnuplotSeries> series;
+    std::string xrange;
+    std::string yrange;
+    std::string zrange;
+    bool is_3dplot;
+  };
+
+  // Write the `plot`/`splot` command for a list of series whose data
+  // are stored in datablocks named `block_prefix` + index
+  void write_plot_command(std::ostream &os,
+                          const std::vector<GnuplotSeries> &list_of_series,
+                          bool is_this_3dplot, const std::string &block_prefix,
+                          const std::string &block_selector,
+                          const std::string &x_range,
+                          const std::string &y_range,
+                          const std::string &z_range) {
+    if (is_this_3dplot) {
+      os << "splot " << x_range << " " << y_range << " " << z_range << " ";
+    } else {
+      os << "plot " << x_range << " " << y_range << " ";
+    }
+
+    // Plot the series we have just defined
+    for (size_t i{}; i < list_of_series.size(); ++i) {
+      const GnuplotSeries &s = list_of_series.at(i);
+      os << block_prefix << i << block_selector << " using " << s.column_range
+         << " with " << style_to_str(s.line_style) << " title '"
+         << escape_quotes(s.title) << "'";
+
+      if (i + 1 < list_of_series.size())
+        os << ", ";
+    }
+  }
+
+  static std::string terminal_command(OutputFormat format,
+                                      const std::string &size) {
+    switch (format) {
+    case OutputFormat::SVG:
+      return "set terminal svg enhanced mouse standalone size " +
+             (size.empty() ? "800,600" : size);
+    case OutputFormat::PDF:
+      return "set terminal pdfcairo color enhanced size " +
+             (size.empty() ? "16cm,12cm" : size);
+    case OutputFormat::DUMB:
+      return "set terminal dumb size " + (size.empty() ? "80,50" : size);
+    default:
+      return "set terminal pngcairo color enhanced size " +
+             (size.empty() ? "800,600" : size);
+    }
+  }
+
+  // Use `terminal` and `output` for the next plots, until
+  // `end_temporary_output` is called. The terminal is saved in a
+  // Gnuplot variable: `set terminal push` cannot be used, as it keeps
+  // only one terminal and `GnuplotPool` needs it
+  bool begin_temporary_output(const std::string &terminal,
+                              const std::string &output) {
+    std::stringstream os;
+    os << "GPLOTPP_SAVED_TERMINAL = GPVAL_TERM\n"
+       << terminal << "\n"
+       << "set output '" << output << "'";
+    return sendcommand(os);
+  }
+
+  // Close the output and restore the terminal. If it was set by
+  // `redirect_to_*`, the same command is sent again to restore its
+  // options too, but without `set output`, which would truncate the file
+  bool end_temporary_output() {
+    if (!sendcommand("unset output"))
+      return false;
+
+    auto it = std::find_if(
+        session_state.begin(), session_state.end(),
+        [](const std::pair<std::string, std::string> &entry) {
+          return entry.first == "output";
+        });
+    if (it == session_state.end())
+      return sendcommand("set terminal @GPLOTPP_SAVED_TERMINAL");
+
+    const std::string terminal{it->second.substr(0, it->second.find('\n'))};
+    return send_state("output", terminal);
+  }
+
+  std::string style_to_str(LineStyle style) {
+    switch (style) {
+    case LineStyle::DOTS:
+      return "dots";
+    case LineStyle::POINTS:
+      return "points";
+    case LineStyle::LINESPOINTS:
+      return "linespoints";
+    case LineStyle::STEPS:
+      return "steps";
+    case LineStyle::BOXES:
+      return "boxes";
+    case LineStyle::X_ERROR_BARS:
+      return "xerrorbars";
+    case LineStyle::Y_ERROR_BARS:
+      return "yerrorbars";
+    case LineStyle::XY_ERROR_BARS:
+      return "xyerrorbars";
+    case LineStyle::VECTORS:
+      return "vectors";
+    default:
+      return "lines";
+    }
+  }
+
+  std::string format_range(double min = NAN, double max = NAN) {
+    if (std::isnan(min) && std::isnan(max))
+      return "[]";
+
+    std::stringstream os;
+    os << "[";
+
+    if (std::isnan(min))
+      os << "*";
+    else
+      os << min;
+
+    os << ":";
+    if (std::isnan(max))
+      os << "*";
+    else
+      os << max;
+
+    os << "]";
+
+    return os.str();
   }
 
-  template <typename T, typename U, typename V, typename W>
-  void plot_xyerr(const std::vector<T> &x, const std::vector<U> &y,
-                  const std::vector<V> &xerr, const std::vector<W> &yerr,
-                  const std::string &label = "") {
-    _plot(label, LineStyle::XY_ERROR_BARS, false, x, y, xerr, yerr);
+  Connection connection;
+  std::vector<GnuplotSeries> series;
+  std::vector<GnuplotFrame> frames{};
+  std::vector<std::string> files_to_delete;
+  std::string xrange;
+  std::string yrange;
+  std::string zrange;
+  bool is_3dplot;
+  Stats pending_stats{};
+  Stats last_show_stats{};
+  Stats total_stats{};
+  StatsCallback stats_callback{};
+  std::shared_ptr<GnuplotTracer> tracer{GnuplotTracer::get_global()};
+  std::shared_ptr<LatencyProbe> latency_probe{};
+  std::unique_ptr<GnuplotResourceMonitor> resource_monitor{};
+  std::function<std::unique_ptr<GnuplotResourceMonitor>(int)> start_monitor{};
+
+  // Used by `restart`
+  std::string restart_command{};
+  GnuplotLaunchOptions launch_options{};
+  bool auto_restart{false};
+  bool restarting{false};
+  size_t num_of_restarts{};
+  // Set until Gnuplot is started (see `GnuplotLaunchOptions::Startup`)
+  std::function<std::unique_ptr<GnuplotBackend>()> deferred_start{};
+  // With `Startup::BACKGROUND`, the launch and what is written before
+  // it completes (sent by `start_session`)
+  using BackgroundLaunch = std::future<std::unique_ptr<GnuplotBackend>>;
+  std::shared_ptr<BackgroundLaunch> background_launch{};
+  std::vector<std::pair<GnuplotBackend::Channel, std::string>>
+      pending_writes{};
+  std::vector<std::pair<std::string, std::string>> session_state{};
+  std::string last_plot_data{};
+  std::string last_plot_commands{};
+  // Set if `render_to_buffer` gave up waiting for an image
+  bool stale_output{false};
+  size_t buffered_bytes{};
+};
+
+/**
+ * A pool of Gnuplot processes kept running in the background
+ *
+ * Starting Gnuplot takes time. A `GnuplotPool` starts a number of
+ * processes in advance and lends them to `Gnuplot` objects, which
+ * give them back once they are destroyed. Before a process is lent
+ * again, its session is reset (terminal, output, settings, variables
+ * and datablocks).
+ *
+ * If all the processes are in use, a new one is started; when it is
+ * given back, it is kept only if the pool holds less than `size` idle
+ * processes. The pool can be used by several threads at once.
+ */
+class GnuplotPool {
+public:
+  explicit GnuplotPool(size_t size, const char *executable_name = "gnuplot",
+                       bool persist = false)
+      : state{std::make_shared<State>()} {
+    state->size = size;
+    state->command = Gnuplot::command_line(executable_name, persist);
+
+    for (size_t i{}; i < size; ++i) {
+      BackendPtr backend{spawn(*state)};
+      if (backend->ok())
+        state->idle.push_back(std::move(backend));
+    }
   }
 
-  template <typename T, typename U, typename V, typename W>
-  void plot_vectors(const std::vector<T> &x, const std::vector<U> &y,
-                    const std::vector<V> &vx, const std::vector<W> &vy,
-                    const std::string &label = "") {
-    _plot(label, LineStyle::VECTORS, false, x, y, vx, vy);
+  GnuplotPool(const GnuplotPool &) = delete;
+  GnuplotPool &operator=(const GnuplotPool &) = delete;
+
+  ~GnuplotPool() {
+    // Processes still leased are terminated by their `Gnuplot` object
+    std::vector<BackendPtr> idle;
+    std::lock_guard<std::mutex> lock{state->mutex};
+    idle.swap(state->idle);
   }
 
-  template <typename T, typename U>
-  void plot3d(const std::vector<T> &x, const std::vector<U> &y,
-              const std::vector<U> &z, const std::string &label = "",
-              LineStyle style = LineStyle::LINES) {
-    _plot(label, style, true, x, y, z);
+  /* Return a `Gnuplot` object using one of the processes in the pool */
+  [[nodiscard]] Gnuplot lease() { return Gnuplot{*this}; }
+
+  /* Return the number of processes ready to be leased */
+  [[nodiscard]] size_t num_of_idle_processes() const {
+    std::lock_guard<std::mutex> lock{state->mutex};
+    return state->idle.size();
   }
 
-  template <typename T, typename U, typename V, typename W>
-  void plot_vectors3d(const std::vector<T> &x, const std::vector<U> &y,
-                      const std::vector<T> &z, const std::vector<V> &vx,
-                      const std::vector<W> &vy, const std::vector<T> &vz,
-                      const std::string &label = "") {
-    _plot(label, LineStyle::VECTORS, true, x, y, z, vx, vy, vz);
+private:
+  friend class Gnuplot;
+
+  using BackendPtr = std::unique_ptr<GnuplotBackend>;
+
+  struct State {
+    mutable std::mutex mutex;
+    std::vector<BackendPtr> idle;
+    size_t size;
+    std::string command;
+    // Terminal used by new Gnuplot processes, or empty if unknown
+    std::string default_terminal;
+  };
+
+  std::shared_ptr<State> state;
+
+  static BackendPtr spawn(State &pool_state) {
+    BackendPtr backend{Gnuplot::start_gnuplot(pool_state.command)};
+    if (backend->ok()) {
+      // Remember the default terminal, so that `reset_session` can
+      // restore it. If the backend cannot tell it (Windows), fall back
+      // to `set terminal push`, which nothing else in gplot++ uses
+      std::string terminal{Gnuplot::query_terminal(*backend)};
+      if (terminal.empty())
+        backend->write_command("set terminal push");
+
+      {
+        std::lock_guard<std::mutex> lock{pool_state.mutex};
+        if (pool_state.default_terminal.empty())
+          pool_state.default_terminal = std::move(terminal);
+      }
+      Gnuplot::initialize_session(*backend);
+    }
+
+    return backend;
   }
 
-  /* Add a point and a X error bar to the list of samples to be plotted */
-  void add_point_xerr(double x, double y, double err) {
-    check_consistency();
+  // Bring a Gnuplot session back to the state it had after `spawn`
+  static bool reset_session(GnuplotBackend &backend,
+                            const std::string &default_terminal) {
+    backend.set_ack_handler(nullptr);
 
-    list_of_x.push_back(x);
-    list_of_y.push_back(y);
-    list_of_xerr.push_back(err);
+    const std::string terminal{default_terminal.empty()
+                                   ? "set terminal pop\nset terminal push"
+                                   : "set terminal " + default_terminal};
+    bool result = backend.write_command("unset multiplot\n"
+                                        "unset output\n" +
+                                        terminal +
+                                        "\n"
+                                        "set print\n"
+                                        "reset session");
+    Gnuplot::initialize_session(backend);
+
+#ifndef _WIN32
+    // Wait until the output file of the previous user is complete
+    result = result && backend.sync(-1, nullptr);
+#endif
+
+    return result;
+  }
+
+  static void give_back(const std::weak_ptr<State> &weak, BackendPtr backend) {
+    // If the pool no longer exists, `backend` is closed here
+    auto pool_state = weak.lock();
+    if (!pool_state)
+      return;
+
+    std::string default_terminal;
+    {
+      std::lock_guard<std::mutex> lock{pool_state->mutex};
+      default_terminal = pool_state->default_terminal;
+    }
+    if (!reset_session(*backend, default_terminal))
+      return;
+
+    std::lock_guard<std::mutex> lock{pool_state->mutex};
+    if (pool_state->idle.size() < pool_state->size)
+      pool_state->idle.push_back(std::move(backend));
+  }
+
+  Gnuplot::Connection acquire() {
+    BackendPtr backend{};
+    {
+      std::lock_guard<std::mutex> lock{state->mutex};
+      if (!state->idle.empty()) {
+        backend = std::move(state->idle.back());
+        state->idle.pop_back();
+      }
+    }
+
+    if (!backend || !backend->ok())
+      backend = spawn(*state);
+
+    Gnuplot::Connection result{std::move(backend)};
+    std::weak_ptr<State> weak{state};
+    result.on_release = [weak](BackendPtr returned) {
+      give_back(weak, std::move(returned));
+    };
+
+    return result;
+  }
+};
+
+inline Gnuplot::Gnuplot(GnuplotPool &pool)
+    : connection{pool.acquire()}, series{}, files_to_delete{},
+      is_3dplot{false} {
+  set_xrange();
+  set_yrange();
+  set_zrange();
+}
+
+#ifndef _WIN32
+/**
+ * A server that lends Gnuplot processes to other programs
+ *
+ * The daemon listens on the Unix socket `path`; each client is served
+ * by its own thread and gets one of the processes of a `GnuplotPool`
+ * until it disconnects. Clients use `GnuplotDaemonBackend`, which
+ * sends datablocks through shared memory. The program `gplotppd` is a
+ * thin wrapper around this class. Not available on Windows.
+ *
+ * If `path` already exists, it is replaced only if it is a socket
+ * where nobody is listening, e.g., because a daemon crashed; otherwise
+ * `ok()` returns `false`.
+ */
+class GnuplotDaemon {
+public:
+  using Message = GnuplotDaemonProtocol::Message;
+
+  GnuplotDaemon(const std::string &path, size_t num_of_processes = 2,
+                const char *executable_name = "gnuplot")
+      : socket_path{path}, pool{num_of_processes, executable_name} {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+      return;
+
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+      return;
+
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+    if (!remove_stale_socket(path) ||
+        bind(listen_fd, reinterpret_cast<sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+      ::close(listen_fd);
+      listen_fd = -1;
+    }
+  }
+
+  GnuplotDaemon(const GnuplotDaemon &) = delete;
+  GnuplotDaemon &operator=(const GnuplotDaemon &) = delete;
+
+  ~GnuplotDaemon() {
+    stop();
+
+    // The threads lock `mutex` before quitting
+    std::vector<std::unique_ptr<Client>> remaining{};
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      remaining.swap(clients);
+    }
+    for (auto &client : remaining)
+      client->worker.join();
+
+    if (listen_fd >= 0) {
+      ::close(listen_fd);
+      unlink(socket_path.c_str());
+    }
+  }
+
+  /* Return `false` if the socket could not be created */
+  [[nodiscard]] bool ok() const { return listen_fd >= 0; }
+
+  /* Accept clients until `stop()` is called */
+  void run() {
+    while (ok() && !stopping) {
+      pollfd pfd{listen_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0)
+        continue;
+
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0)
+        continue;
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+      const int one{1};
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+      std::lock_guard<std::mutex> lock{mutex};
+      // `stop()` might have been called after the check above, and it
+      // would not know about this client
+      if (stopping) {
+        ::close(fd);
+        break;
+      }
+      join_finished_clients();
+
+      auto client = std::make_unique<Client>();
+      client->fd = fd;
+      Client *ptr = client.get();
+      client->worker = std::thread{[this, ptr]() {
+        serve(ptr->fd);
+
+        std::lock_guard<std::mutex> client_lock{mutex};
+        ::close(ptr->fd);
+        ptr->fd = -1;
+        ptr->done = true;
+      }};
+      clients.push_back(std::move(client));
+    }
+  }
+
+  /* Make `run()` return and disconnect every client. This can be
+   * called from any thread */
+  void stop() {
+    stopping = true;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    for (auto &client : clients) {
+      if (client->fd >= 0)
+        shutdown(client->fd, SHUT_RDWR);
+    }
+  }
+
+  /* Return the number of clients currently connected */
+  [[nodiscard]] size_t num_of_clients() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return static_cast<size_t>(
+        std::count_if(clients.begin(), clients.end(),
+                      [](const std::unique_ptr<Client> &client) {
+                        return !client->done;
+                      }));
+  }
+
+private:
+  struct Client {
+    int fd{-1};
+    bool done{false};
+    std::thread worker{};
+  };
+
+  // Make room for our socket at `path`. Return `false` if something
+  // there must not be removed: a file that is not a socket, or a
+  // socket where another daemon is listening
+  static bool remove_stale_socket(const std::string &path) {
+    struct stat info{};
+    if (lstat(path.c_str(), &info) != 0)
+      return errno == ENOENT;
+    if (!S_ISSOCK(info.st_mode))
+      return false;
+
+    int fd = GnuplotDaemonProtocol::connect_to(path);
+    if (fd >= 0) {
+      ::close(fd);
+      return false;
+    }
+
+    // Other errors (e.g., EAGAIN if the queue of the daemon is full)
+    // do not prove that nobody is listening
+    return errno == ECONNREFUSED && unlink(path.c_str()) == 0;
+  }
+
+  // Must be called with `mutex` locked
+  void join_finished_clients() {
+    for (auto it = clients.begin(); it != clients.end();) {
+      if ((*it)->done) {
+        (*it)->worker.join();
+        it = clients.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void serve(int fd) {
+    Message type;
+    std::string payload;
+    int ring_fd{-1};
+    if (!GnuplotDaemonProtocol::receive_message(fd, type, payload,
+                                                &ring_fd) ||
+        type != Message::HELLO || ring_fd < 0) {
+      if (ring_fd >= 0)
+        ::close(ring_fd);
+      return;
+    }
+
+    GnuplotSharedRing ring{};
+    if (!ring.attach(ring_fd))
+      return;
+
+    // The process goes back to the pool when `plt` is destroyed
+    Gnuplot plt{pool.lease()};
+    GnuplotBackend *backend{plt.get_backend()};
+    if (!plt.ok())
+      return;
+
+    const std::string output_file{backend->output_file()};
+    if (!GnuplotDaemonProtocol::send_message(fd, Message::WELCOME,
+                                             output_file.data(),
+                                             output_file.size()))
+      return;
+
+    bool result{true};
+    while (result && !stopping &&
+           GnuplotDaemonProtocol::receive_message(fd, type, payload)) {
+      switch (type) {
+      case Message::COMMAND:
+        result = backend->write(GnuplotBackend::Channel::COMMAND,
+                                payload.data(), payload.size());
+        break;
+
+      case Message::DATA: {
+        uint64_t size{};
+        result = payload.size() == sizeof(size);
+        if (result) {
+          std::memcpy(&size, payload.data(), sizeof(size));
+          result = ring.read(static_cast<size_t>(size),
+                             [backend](const char *buf, size_t count) {
+                               return backend->write(
+                                   GnuplotBackend::Channel::DATA, buf, count);
+                             });
+        }
+        break;
+      }
+
+      case Message::FLUSH:
+        result = backend->flush();
+        break;
+
+      case Message::SYNC: {
+        int32_t timeout_ms{};
+        result = payload.size() == sizeof(timeout_ms) + 1;
+        if (!result)
+          break;
+        std::memcpy(&timeout_ms, payload.data(), sizeof(timeout_ms));
+
+        std::string output{};
+        const char synced{
+            backend->sync(timeout_ms, payload.back() ? &output : nullptr)};
+        for (size_t start{}; result && start < output.size();
+             start += GnuplotDaemonProtocol::OUTPUT_CHUNK) {
+          result = GnuplotDaemonProtocol::send_message(
+              fd, Message::OUTPUT, output.data() + start,
+              std::min(output.size() - start,
+                       GnuplotDaemonProtocol::OUTPUT_CHUNK));
+        }
+        result = result && GnuplotDaemonProtocol::send_message(
+                               fd, Message::SYNC_DONE, &synced, 1);
+        break;
+      }
+
+      case Message::DRAIN:
+        // Every `DATA` message before this one has been consumed
+        result = GnuplotDaemonProtocol::send_message(fd, Message::DRAINED,
+                                                     nullptr, 0);
+        break;
+
+      default:
+        result = false;
+      }
+    }
+  }
+
+  std::string socket_path;
+  GnuplotPool pool;
+  int listen_fd{-1};
+  std::atomic<bool> stopping{false};
+  mutable std::mutex mutex{};
+  std::vector<std::unique_ptr<Client>> clients{};
+};
+#endif
+
+/**
+ * Render many independent plots in parallel
+ *
+ * A `GnuplotBatch` runs a number of worker threads, each driving its
+ * own Gnuplot process. Jobs are submitted with the name of the output
+ * file and a function that fills a `Gnuplot` object; the terminal is
+ * chosen from the extension of the file (`.png`, `.svg`, `.pdf`, or
+ * `.txt` for the `dumb` terminal).
+ *
+ * Jobs wait in a single queue, and a worker that becomes idle takes
+ * the job with the highest priority; among jobs with the same
+ * priority, the one submitted first. For the `dumb` terminal, the
+ * size of the job is in the format "WIDTH,HEIGHT" (in characters).
+ * Once the output file of a job has been completed, its callback is
+ * called from the worker thread. If the drawing function throws an
+ * exception, the job fails and the worker goes on with the next one.
+ */
+class GnuplotBatch {
+public:
+  using DrawFunction = std::function<void(Gnuplot &)>;
+  using DoneFunction =
+      std::function<void(const std::string &output, bool success)>;
+
+  struct Job {
+    std::string output;
+    DrawFunction draw;
+    int priority{};
+    DoneFunction on_done{};
+    std::string size{}; // Use the default of `redirect_to_*` if empty
+  };
+
+  explicit GnuplotBatch(size_t num_of_workers = 0,
+                        const char *executable_name = "gnuplot")
+      : pool{actual_num_of_workers(num_of_workers), executable_name} {
+    for (size_t i{}; i < actual_num_of_workers(num_of_workers); ++i)
+      workers.emplace_back([this]() { work(); });
+  }
+
+  GnuplotBatch(const GnuplotBatch &) = delete;
+  GnuplotBatch &operator=(const GnuplotBatch &) = delete;
+
+  /* Wait for all the jobs to be completed and stop the workers */
+  ~GnuplotBatch() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+    work_available.notify_all();
+
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  void submit(Job job) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      jobs.push_back(QueuedJob{std::move(job), next_sequence++});
+      std::push_heap(jobs.begin(), jobs.end(), lower_priority);
+      ++num_of_unfinished;
+    }
+    work_available.notify_one();
+  }
+
+  void submit(const std::string &output, DrawFunction draw, int priority = 0,
+              DoneFunction on_done = {}) {
+    submit(Job{output, std::move(draw), priority, std::move(on_done)});
+  }
+
+  /* Block until all the jobs submitted so far have been completed */
+  void wait() {
+    std::unique_lock<std::mutex> lock{mutex};
+    all_done.wait(lock, [this]() { return num_of_unfinished == 0; });
+  }
+
+  [[nodiscard]] size_t num_of_workers() const { return workers.size(); }
+
+private:
+  struct QueuedJob {
+    Job job;
+    unsigned long sequence{};
+  };
+
+  // Jobs with the same priority are run in the order of submission
+  static bool lower_priority(const QueuedJob &a, const QueuedJob &b) {
+    if (a.job.priority != b.job.priority)
+      return a.job.priority < b.job.priority;
+    return a.sequence > b.sequence;
+  }
+
+  static size_t actual_num_of_workers(size_t n) {
+    if (n > 0)
+      return n;
+
+    size_t cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+  }
+
+  static bool redirect(Gnuplot &plt, const Job &job) {
+    const std::string &output = job.output;
+    auto ends_with = [&output](const char *suffix) {
+      std::string s{suffix};
+      return output.size() >= s.size() &&
+             output.compare(output.size() - s.size(), s.size(), s) == 0;
+    };
+
+    if (ends_with(".png"))
+      return job.size.empty() ? plt.redirect_to_png(output)
+                              : plt.redirect_to_png(output, job.size);
+    if (ends_with(".svg"))
+      return job.size.empty() ? plt.redirect_to_svg(output)
+                              : plt.redirect_to_svg(output, job.size);
+    if (ends_with(".pdf"))
+      return job.size.empty() ? plt.redirect_to_pdf(output)
+                              : plt.redirect_to_pdf(output, job.size);
+    if (ends_with(".txt")) {
+      if (job.size.empty())
+        return plt.redirect_to_dumb(output);
+
+      unsigned int width{}, height{};
+      char comma{};
+      std::istringstream is{job.size};
+      if (!(is >> width >> comma >> height) || comma != ',')
+        return false;
+      return plt.redirect_to_dumb(output, width, height);
+    }
+
+    return false;
+  }
+
+  bool run(const Job &job) {
+    Gnuplot plt{pool};
+    if (!plt.ok() || !redirect(plt, job))
+      return false;
+
+    if (job.draw) {
+      try {
+        job.draw(plt);
+      } catch (...) {
+        // Do not leave the file open in the process, which goes back
+        // to the pool
+        plt.sendcommand("unset output");
+        return false;
+      }
+    }
+
+    // Close the output file, so that it is complete when `sync` returns
+    bool result = plt.show() && plt.sendcommand("unset output");
+#ifndef _WIN32
+    result = result && plt.sync();
+#endif
+    return result;
+  }
+
+  void work() {
+    while (true) {
+      QueuedJob queued;
+      {
+        std::unique_lock<std::mutex> lock{mutex};
+        work_available.wait(lock,
+                            [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+          return; // We are stopping and there is nothing left to do
+
+        std::pop_heap(jobs.begin(), jobs.end(), lower_priority);
+        queued = std::move(jobs.back());
+        jobs.pop_back();
+      }
+
+      bool success{run(queued.job)};
+      if (queued.job.on_done) {
+        try {
+          queued.job.on_done(queued.job.output, success);
+        } catch (...) {
+          // There is nobody to report this to, and the worker must
+          // not die
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (--num_of_unfinished == 0)
+          all_done.notify_all();
+      }
+    }
   }
 
-  /* Add a point and a Y error bar to the list of samples to be plotted */
-  void add_point_yerr(double x, double y, double err) {
-    check_consistency();
+  GnuplotPool pool;
+  std::vector<std::thread> workers{};
+
+  std::mutex mutex{};
+  std::condition_variable work_available{};
+  std::condition_variable all_done{};
+  std::vector<QueuedJob> jobs{}; // A heap, see `lower_priority`
+  unsigned long next_sequence{};
+  size_t num_of_unfinished{};
+  bool stopping{};
+};
+
+/**
+ * Render the frames of an animation in parallel
+ *
+ * Each frame is saved in a separate PNG file by one of several Gnuplot
+ * processes (see `GnuplotBatch`), and the files can then be joined in
+ * an animated GIF by `assemble_gif`.
+ *
+ * Since frames are drawn independently, all of them get the same
+ * ranges for the axes. They can be fixed through `set_xrange`,
+ * `set_yrange`, and `set_zrange`; the bounds that are left unspecified
+ * are computed by calling the drawing function for every frame in
+ * advance (with no Gnuplot process) and taking the minimum and maximum
+ * of the points of all the series. Error bars, arrows, and the width
+ * of histogram boxes are not considered. Ranges set by the drawing
+ * function itself take precedence.
+ */
+class GnuplotAnimationRenderer {
+public:
+  using DrawFunction = std::function<void(Gnuplot &, size_t frame)>;
+
+  explicit GnuplotAnimationRenderer(size_t num_of_workers = 0,
+                                    const char *executable_name = "gnuplot")
+      : batch{num_of_workers, executable_name},
+        executable_name{executable_name} {}
+
+  void set_xrange(double min = NAN, double max = NAN) { xrange = {min, max}; }
+  void set_yrange(double min = NAN, double max = NAN) { yrange = {min, max}; }
+  void set_zrange(double min = NAN, double max = NAN) { zrange = {min, max}; }
+
+  /* Set the size of the frames, in the format used by
+   * `Gnuplot::redirect_to_png` */
+  void set_size(const std::string &new_size) { size = new_size; }
+
+  /* Call `draw` for frames 0…num_of_frames-1 and save each of them in
+   * a PNG file. The name of the file is built by passing the number of
+   * the frame to `pattern`, which must contain exactly one printf-style
+   * integer conversion like `%06d` (use `%%` for a literal `%`). If
+   * some range of the axes has not been set, `draw` is called twice
+   * for each frame (see above). Return `true` if all the frames were
+   * saved successfully. */
+  bool render(size_t num_of_frames, DrawFunction draw,
+              const std::string &pattern = "frame_%06d.png") {
+    if (!valid_pattern(pattern))
+      return false;
+
+    const Bounds bounds{needs_bounds() ? compute_bounds(num_of_frames, draw)
+                                       : Bounds{}};
+    const auto x = bounds.range(0, xrange);
+    const auto y = bounds.range(1, yrange);
+    const auto z = bounds.range(2, zrange);
+
+    std::atomic<size_t> num_of_failures{};
+    for (size_t i{}; i < num_of_frames; ++i) {
+      GnuplotBatch::Job job{};
+      job.output = frame_file_name(pattern, i);
+      job.size = size;
+      job.draw = [&draw, i, x, y, z](Gnuplot &plt) {
+        // Set the ranges first, so that `draw` can override them
+        plt.set_xrange(x.first, x.second);
+        plt.set_yrange(y.first, y.second);
+        plt.set_zrange(z.first, z.second);
+
+        draw(plt, i);
+      };
+      job.on_done = [&num_of_failures](const std::string &, bool success) {
+        if (!success)
+          ++num_of_failures;
+      };
+
+      batch.submit(std::move(job));
+    }
+
+    batch.wait();
 
-    list_of_x.push_back(x);
-    list_of_y.push_back(y);
-    list_of_yerr.push_back(err);
+    last_pattern = pattern;
+    last_num_of_frames = num_of_frames;
+    return num_of_failures == 0;
   }
 
-  /* Add a point and two X/Y error bars to the list of samples to be plotted */
-  void add_point_xyerr(double x, double y, double xerr, double yerr) {
-    check_consistency();
+  /* Join the frames saved by the last call to `render` in an animated
+   * GIF, using one Gnuplot process. The meaning of the parameters is
+   * the same as in `Gnuplot::redirect_to_animated_gif`. */
+  bool assemble_gif(const std::string &filename, int delay_ms = 50,
+                    bool loop = true) {
+    if (last_num_of_frames == 0)
+      return false;
 
-    list_of_x.push_back(x);
-    list_of_y.push_back(y);
-    list_of_xerr.push_back(xerr);
-    list_of_yerr.push_back(yerr);
-  }
-  /* Add a point to the list of samples to be plotted */
-  void add_point(double x, double y) {
-    check_consistency();
+    Gnuplot plt{executable_name.c_str(), false};
+    bool result = plt.redirect_to_animated_gif(
+        filename, size.empty() ? "800,600" : size, delay_ms, loop);
 
-    list_of_x.push_back(x);
-    list_of_y.push_back(y);
-  }
+    // Gnuplot is able to read PNG files and plot them as images
+    std::stringstream os;
+    os << "unset border\n"
+       << "unset tics\n"
+       << "unset key\n"
+       << "set margins 0, 0, 0, 0\n"
+       << "set autoscale xfix\n"
+       << "set autoscale yfix\n"
+       << "do for [i=0:" << last_num_of_frames - 1 << "] { plot sprintf('"
+       << plt.escape_quotes(last_pattern)
+       << "', i) binary filetype=png with rgbimage }\n"
+       << "unset output";
+    result = result && plt.sendcommand(os);
 
-  /* Add a value to the list of samples to be plotted */
-  void add_point(double y) {
-    add_point(static_cast<double>(list_of_x.size()), y);
+#ifndef _WIN32
+    result = result && plt.sync();
+#endif
+    return result;
   }
 
-  /* Return the number of points added by `add_point` */
-  [[nodiscard]] int get_num_of_points() const {
-    check_consistency();
+private:
+  // Minimum and maximum of the coordinates along each axis
+  struct Bounds {
+    double min[3]{INFINITY, INFINITY, INFINITY};
+    double max[3]{-INFINITY, -INFINITY, -INFINITY};
 
-    return (int)list_of_x.size();
-  }
+    void add(size_t axis, double value) {
+      if (std::isfinite(value)) {
+        min[axis] = std::min(min[axis], value);
+        max[axis] = std::max(max[axis], value);
+      }
+    }
 
-  /* Return the list of abscissas for the points added by `add_point` */
-  [[nodiscard]] const std::vector<double> &get_points_x() const {
-    return list_of_x;
-  }
+    void add(const Bounds &other) {
+      for (size_t axis{}; axis < 3; ++axis) {
+        add(axis, other.min[axis]);
+        add(axis, other.max[axis]);
+      }
+    }
 
-  /* Return the list of ordinates for the points added by `add_point` */
-  [[nodiscard]] const std::vector<double> &get_points_y() const {
-    return list_of_y;
+    // Fill the bounds left unspecified in `range` (NaN)
+    std::pair<double, double> range(size_t axis,
+                                    std::pair<double, double> result) const {
+      if (min[axis] <= max[axis]) {
+        if (std::isnan(result.first))
+          result.first = min[axis];
+        if (std::isnan(result.second))
+          result.second = max[axis];
+      }
+      return result;
+    }
+  };
+
+  bool needs_bounds() const {
+    for (const auto &range : {xrange, yrange, zrange}) {
+      if (std::isnan(range.first) || std::isnan(range.second))
+        return true;
+    }
+    return false;
   }
 
-  /* Create a plot using the values set with the method `add_point` */
-  void plot(const std::string &label = "", LineStyle style = LineStyle::LINES) {
-    check_consistency();
+  // Call `draw` for every frame, in parallel, on `Gnuplot` objects that
+  // send nothing, and take the bounds of the series they create
+  Bounds compute_bounds(size_t num_of_frames, const DrawFunction &draw) {
+    const size_t num_of_threads{std::max<size_t>(
+        1, std::min<size_t>(std::thread::hardware_concurrency(),
+                            num_of_frames))};
+    std::vector<Bounds> partial(num_of_threads);
+    std::atomic<size_t> next_frame{};
 
-    _plot(label, style, false, list_of_x, list_of_y);
+    std::vector<std::thread> threads{};
+    for (size_t t{}; t < num_of_threads; ++t) {
+      threads.emplace_back([&, t]() {
+        size_t frame;
+        while ((frame = next_frame++) < num_of_frames) {
+          Gnuplot scratch{std::make_unique<GnuplotNullBackend>()};
+          try {
+            draw(scratch, frame);
+          } catch (...) {
+            // The frame will fail again when it is actually drawn
+            continue;
+          }
+          add_series_bounds(scratch, partial[t]);
+        }
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+
+    Bounds result{};
+    for (const auto &bounds : partial)
+      result.add(bounds);
+    return result;
   }
 
-  /* Create a plot with X error bars using the values set with the method
-   * `add_point` */
-  void plot_xerr(const std::string &label = "") {
-    check_consistency();
+  static void add_series_bounds(const Gnuplot &plt, Bounds &bounds) {
+    for (const auto &series : plt.series) {
+      const size_t num_of_columns{static_cast<size_t>(std::count(
+                                      series.column_range.begin(),
+                                      series.column_range.end(), ':')) +
+                                  1};
+      std::istringstream is{series.data_string};
+      std::string line;
+      size_t index{};
+      while (std::getline(is, line)) {
+        std::istringstream fields{line};
+        double value;
+        if (num_of_columns == 1) {
+          // Gnuplot uses the index of the point as the X coordinate
+          if (fields >> value) {
+            bounds.add(0, static_cast<double>(index++));
+            bounds.add(1, value);
+          }
+          continue;
+        }
 
-    plot_xerr(list_of_x, list_of_y, list_of_xerr, label);
+        const size_t num_of_axes{plt.is_3dplot ? size_t{3} : size_t{2}};
+        for (size_t axis{}; axis < num_of_axes && fields >> value; ++axis)
+          bounds.add(axis, value);
+      }
+    }
   }
 
-  /* Create a plot with X error bars using the values set with the method
-   * `add_point` */
-  void plot_yerr(const std::string &label = "") {
-    check_consistency();
+  // Check that `pattern` contains exactly one integer conversion and
+  // nothing else that `snprintf` would interpret
+  static bool valid_pattern(const std::string &pattern) {
+    size_t num_of_conversions{};
+    for (size_t i{}; i < pattern.size(); ++i) {
+      if (pattern[i] != '%')
+        continue;
 
-    plot_yerr(list_of_x, list_of_y, list_of_yerr, label);
-  }
+      if (++i < pattern.size() && pattern[i] == '%')
+        continue;
 
-  /* Create a plot with X error bars using the values set with the method
-   * `add_point` */
-  void plot_xyerr(const std::string &label = "") {
-    check_consistency();
+      while (i < pattern.size() &&
+             std::strchr("-+ #0123456789.", pattern[i]) != nullptr)
+        ++i;
+      if (i == pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i'))
+        return false;
+      ++num_of_conversions;
+    }
 
-    plot_xyerr(list_of_x, list_of_y, list_of_xerr, list_of_yerr, label);
+    return num_of_conversions == 1;
   }
 
-  template <typename T>
-  void histogram(const std::vector<T> &values, size_t nbins,
-                 const std::string &label = "",
-                 LineStyle style = LineStyle::BOXES) {
-    assert(nbins > 0);
+  static std::string frame_file_name(const std::string &pattern,
+                                     size_t frame) {
+    std::vector<char> buf(pattern.size() + 32);
+    std::snprintf(buf.data(), buf.size(), pattern.c_str(),
+                  static_cast<int>(frame));
+    return std::string{buf.data()};
+  }
 
-    if (values.empty())
-      return;
+  GnuplotBatch batch;
+  std::string executable_name;
+  std::pair<double, double> xrange{NAN, NAN};
+  std::pair<double, double> yrange{NAN, NAN};
+  std::pair<double, double> zrange{NAN, NAN};
+  std::string size{};
+  std::string last_pattern{};
+  size_t last_num_of_frames{};
+};
 
-    if (!series.empty()) {
-      assert(!is_3dplot);
+/**
+ * Produce the frames of an animation on several threads
+ *
+ * When computing the data of a frame is expensive, calling `plot()`
+ * and `show()` in a loop keeps the Gnuplot pipe idle most of the
+ * time. A `GnuplotAnimationBuilder` calls the function producing the
+ * frames on a number of worker threads, each using a private
+ * `Gnuplot` object that records commands instead of sending them, and
+ * writes the frames to the real `Gnuplot` object strictly in order.
+ * Workers never run more than `max_frames_ahead` frames ahead of the
+ * last frame that was written.
+ *
+ * The function is called concurrently by the workers, so it must not
+ * modify shared data without synchronization. Besides `plot` and
+ * friends, it can call any method that sends commands (e.g.,
+ * `set_title`): the commands are sent along with the frame.
+ */
+class GnuplotAnimationBuilder {
+public:
+  using FrameFunction = std::function<void(Gnuplot &, size_t frame)>;
+
+  explicit GnuplotAnimationBuilder(size_t num_of_workers = 0,
+                                   size_t max_frames_ahead = 0)
+      : num_of_workers{num_of_workers}, max_frames_ahead{max_frames_ahead} {
+    if (this->num_of_workers == 0) {
+      size_t cores = std::thread::hardware_concurrency();
+      this->num_of_workers = cores > 1 ? cores - 1 : 1;
     }
 
-    auto min_iter = std::min_element(values.begin(), values.end());
-    auto max_iter = std::max_element(values.begin(), values.end());
-    double min, max, binwidth;
+    if (this->max_frames_ahead == 0)
+      this->max_frames_ahead = 2 * this->num_of_workers;
+  }
 
-    std::vector<size_t> bins{};
+  /* Call `produce` for frames 0…num_of_frames-1 and send each frame
+   * to `plt`, as if `show()` were called after each of them. Return
+   * `false` if a frame could not be sent, or if `produce` threw an
+   * exception; in this case the remaining frames are skipped. */
+  bool run(Gnuplot &plt, size_t num_of_frames, FrameFunction produce) {
+    State state{};
+    state.num_of_frames = num_of_frames;
 
-    // Check if all the elements are the same
-    if (min_iter != max_iter) {
-      min = *min_iter;
-      max = *max_iter;
-      binwidth = (max - min) / nbins;
+    std::vector<std::thread> workers{};
+    for (size_t i{}; i < std::min(num_of_workers, num_of_frames); ++i)
+      workers.emplace_back([&]() { work(state, produce); });
 
-      bins.resize(nbins);
-      for (const auto &val : values) {
-        int index = static_cast<int>((val - min) / binwidth);
-        if (index >= int(nbins))
-          --index;
+    bool result{true};
+    for (size_t frame{}; frame < num_of_frames; ++frame) {
+      Frame ready{};
+      {
+        std::unique_lock<std::mutex> lock{state.mutex};
+        state.frame_ready.wait(lock, [&]() {
+          return state.ready.find(frame) != state.ready.end() ||
+                 frame >= state.first_failed;
+        });
 
-        bins.at(index)++;
+        if (frame >= state.first_failed) {
+          result = false;
+          break;
+        }
+
+        auto it = state.ready.find(frame);
+        ready = std::move(it->second);
+        state.ready.erase(it);
+        ++state.next_to_write;
       }
-    } else {
-      // Just one bin…
+      state.slot_free.notify_all();
 
-      min = max = *min_iter;
-      binwidth = 1.0;
-      nbins = 1;
-      bins.push_back(static_cast<double>(values.size()));
+      if (!plt.show_serialized(ready.data, ready.commands,
+                               ready.num_of_series, ready.num_of_points)) {
+        result = false;
+        break;
+      }
     }
 
-    std::stringstream of;
-    for (size_t i{}; i < nbins; ++i) {
-      of << min + binwidth * (i + 0.5) << " " << bins[i] << "\n";
+    {
+      std::lock_guard<std::mutex> lock{state.mutex};
+      state.stop = true;
     }
+    state.slot_free.notify_all();
 
-    series.push_back(GnuplotSeries{of.str(), style, label, "1:2"});
-    is_3dplot = false;
-  }
+    for (auto &worker : workers)
+      worker.join();
 
-  // Ask Gnuplot to use a multiple-plot layout
-  bool multiplot(int nrows, int ncols, const std::string &title = "") {
-    std::stringstream os;
-    os << "set multiplot layout " << nrows << ", " << ncols << " title '"
-       << escape_quotes(title) << "'\n";
-    return sendcommand(os);
+    return result;
   }
 
-  // Force Gnuplot to draw all the series sent through any of the `plot`
-  // commands
-  bool show(bool call_reset = true) {
-    if (series.empty())
-      return true;
+private:
+  // A frame serialized by a worker, ready to be sent to Gnuplot
+  struct Frame {
+    std::string data;
+    std::string commands;
+    size_t num_of_series;
+    size_t num_of_points;
+  };
 
-    std::stringstream os;
-    os << "set style fill solid 0.5\n";
+  struct State {
+    std::mutex mutex{};
+    std::condition_variable frame_ready{};
+    std::condition_variable slot_free{};
+    std::map<size_t, Frame> ready{};
+    size_t num_of_frames{};
+    size_t next_to_produce{};
+    size_t next_to_write{};
+    // Lowest frame for which `produce` threw an exception
+    size_t first_failed{std::numeric_limits<size_t>::max()};
+    bool stop{};
+  };
 
-    // Write the data in separate series
-    for (size_t i{}; i < series.size(); ++i) {
-      const GnuplotSeries &s = series.at(i);
-      os << "$Datablock" << i << " << EOD\n" << s.data_string << "\nEOD\n";
-    }
+  void work(State &state, const FrameFunction &produce) {
+    // Record the commands of each frame instead of sending them
+    auto recorder = std::make_unique<GnuplotRecordingBackend>();
+    GnuplotRecordingBackend &recording = *recorder;
+    Gnuplot scratch{std::move(recorder)};
+    recording.clear();
 
-    if (is_3dplot) {
-      os << "splot " << xrange << " " << yrange << " " << zrange << " ";
-    } else {
-      os << "plot " << xrange << " " << yrange << " ";
-    }
+    while (true) {
+      size_t frame;
+      {
+        std::unique_lock<std::mutex> lock{state.mutex};
+        state.slot_free.wait(lock, [&]() {
+          return state.stop || state.next_to_produce >= state.num_of_frames ||
+                 state.next_to_produce < state.next_to_write + max_frames_ahead;
+        });
 
-    // Plot the series we have just defined
-    for (size_t i{}; i < series.size(); ++i) {
-      const GnuplotSeries &s = series.at(i);
-      os << "$Datablock" << i << " using " << s.column_range << " with "
-         << style_to_str(s.line_style) << " title '" << escape_quotes(s.title)
-         << "'";
+        if (state.stop || state.next_to_produce >= state.num_of_frames ||
+            state.next_to_produce >= state.first_failed)
+          return;
 
-      if (i + 1 < series.size())
-        os << ", ";
-    }
+        frame = state.next_to_produce++;
+      }
 
-    bool result = sendcommand(os);
-    if (result && call_reset)
-      reset();
+      try {
+        produce(scratch, frame);
+      } catch (...) {
+        // Frames before this one are still written
+        {
+          std::lock_guard<std::mutex> lock{state.mutex};
+          state.first_failed = std::min(state.first_failed, frame);
+        }
+        state.frame_ready.notify_all();
+        return;
+      }
 
-    return result;
-  }
+      Frame result{{}, {}, scratch.series.size(), 0};
+      for (const auto &series : scratch.series)
+        result.num_of_points += series.num_of_points;
 
-  // Remove all the series from memory and start with a blank plot
-  void reset() {
-    series.clear();
-    set_xrange();
-    set_yrange();
-    is_3dplot = false;
+      scratch.show();
+      result.data = recording.str(GnuplotBackend::Channel::DATA);
+      result.commands = recording.str(GnuplotBackend::Channel::COMMAND);
+      recording.clear();
+
+      {
+        std::lock_guard<std::mutex> lock{state.mutex};
+        state.ready[frame] = std::move(result);
+      }
+      state.frame_ready.notify_all();
+    }
   }
 
-private:
-  void _print_ith_elements(std::ostream &, std::ostream &, int, size_t) {}
+  size_t num_of_workers;
+  size_t max_frames_ahead;
+};
 
-  template <typename T, typename... Args>
-  void _print_ith_elements(std::ostream &os, std::ostream &fmts, int index,
-                           size_t i, const std::vector<T> &v, Args... args) {
-    os << v[i] << " ";
+/**
+ * Refresh a plot continuously, without ever falling behind
+ *
+ * Threads producing data call `submit` with a function that draws the
+ * current state on a `Gnuplot` object. A background thread, which owns
+ * the `Gnuplot` object, calls the latest function at most `max_fps`
+ * times per second, calls `Gnuplot::show()`, and waits until Gnuplot
+ * has drawn the plot before taking the next one. If a function is
+ * submitted while another is still waiting, the older one is dropped
+ * without being called, so no time is spent formatting frames that
+ * would never be seen. If a function throws an exception, its frame
+ * is discarded and counted in `Counters::failed`. If Gnuplot does not
+ * accept a frame, the frame is counted in `Counters::lost`; if the
+ * process has quit and cannot be restarted (see
+ * `Gnuplot::restart()`), the view stops drawing and `ok()` returns
+ * `false`.
+ */
+class GnuplotLiveView {
+public:
+  using DrawFunction = std::function<void(Gnuplot &)>;
 
-    if (i == 0) {
-      if (index > 1)
-        fmts << ':';
-      fmts << index;
-    }
+  struct Counters {
+    // Calls to `submit`
+    size_t submitted{};
+    // Frames sent to Gnuplot
+    size_t rendered{};
+    // Frames replaced by a newer one before being drawn
+    size_t dropped{};
+    // Frames whose drawing function threw an exception
+    size_t failed{};
+    // Frames that could not be sent to Gnuplot
+    size_t lost{};
+  };
 
-    _print_ith_elements(os, fmts, index + 1, i, args...);
+  explicit GnuplotLiveView(Gnuplot gnuplot, double max_fps = 30.0)
+      : plt{std::move(gnuplot)} {
+    set_max_fps(max_fps);
+    worker = std::thread{[this]() { work(); }};
   }
 
-  template <typename T, typename... Args>
-  void _plot(const std::string &label, LineStyle style, bool is_this_3dplot,
-             const std::vector<T> &v, Args... args) {
-    if (v.empty())
-      return;
+  GnuplotLiveView(const GnuplotLiveView &) = delete;
+  GnuplotLiveView &operator=(const GnuplotLiveView &) = delete;
 
-    if (!series.empty()) {
-      // Check that we are not adding a 3D plot to a 2D plot, or vice versa
-      assert(is_3dplot == is_this_3dplot);
+  /* Draw the frame still pending, if any, and stop the thread */
+  ~GnuplotLiveView() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
     }
+    frame_available.notify_all();
+    worker.join();
+  }
 
-    std::stringstream of;
-    std::stringstream fmtstring;
-    for (size_t i{}; i < v.size(); ++i) {
-      _print_ith_elements(of, fmtstring, 1, i, v, args...);
-      of << "\n";
+  /* Make `draw` the next frame to be drawn. Return `false` if it
+   * replaced a frame that had not been drawn yet, or if the view has
+   * stopped drawing (see `ok()`) */
+  bool submit(DrawFunction draw) {
+    bool replaced;
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      if (broken) {
+        ++counters.submitted;
+        ++counters.dropped;
+        return false;
+      }
+
+      replaced = static_cast<bool>(pending);
+      pending = std::move(draw);
+      ++counters.submitted;
+      if (replaced)
+        ++counters.dropped;
     }
+    frame_available.notify_all();
+    return !replaced;
+  }
 
-    series.push_back(GnuplotSeries{of.str(), style, label, fmtstring.str()});
-    is_3dplot = is_this_3dplot;
+  /* Change the maximum number of frames drawn per second; zero or
+   * negative values remove the limit */
+  void set_max_fps(double max_fps) {
+    std::lock_guard<std::mutex> lock{mutex};
+    min_interval =
+        max_fps > 0 ? std::chrono::duration_cast<clock::duration>(
+                          std::chrono::duration<double>(1.0 / max_fps))
+                    : clock::duration::zero();
   }
 
-  struct GnuplotSeries {
-    std::string data_string;
-    LineStyle line_style;
-    std::string title;
-    std::string column_range;
-  };
+  /* Block until the frames submitted so far have been drawn or dropped */
+  void flush() {
+    std::unique_lock<std::mutex> lock{mutex};
+    frame_done.wait(lock, [this]() { return !pending && !drawing; });
+  }
 
-  std::string style_to_str(LineStyle style) {
-    switch (style) {
-    case LineStyle::DOTS:
-      return "dots";
-    case LineStyle::POINTS:
-      return "points";
-    case LineStyle::LINESPOINTS:
-      return "linespoints";
-    case LineStyle::STEPS:
-      return "steps";
-    case LineStyle::BOXES:
-      return "boxes";
-    case LineStyle::X_ERROR_BARS:
-      return "xerrorbars";
-    case LineStyle::Y_ERROR_BARS:
-      return "yerrorbars";
-    case LineStyle::XY_ERROR_BARS:
-      return "xyerrorbars";
-    case LineStyle::VECTORS:
-      return "vectors";
-    default:
-      return "lines";
-    }
+  [[nodiscard]] Counters get_counters() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return counters;
   }
 
-  std::string format_range(double min = NAN, double max = NAN) {
-    if (std::isnan(min) && std::isnan(max))
-      return "[]";
+  /* Return `false` if the view has stopped drawing because Gnuplot has
+   * quit and could not be restarted */
+  [[nodiscard]] bool ok() const {
+    std::lock_guard<std::mutex> lock{mutex};
+    return !broken;
+  }
 
-    std::stringstream os;
-    os << "[";
+private:
+  using clock = std::chrono::steady_clock;
 
-    if (std::isnan(min))
-      os << "*";
-    else
-      os << min;
+  // Longest time Gnuplot can take to draw a frame before we move on
+  static const int SYNC_TIMEOUT_MS = 10000;
 
-    os << ":";
-    if (std::isnan(max))
-      os << "*";
-    else
-      os << max;
+  void work() {
+    clock::time_point last_frame{};
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+      frame_available.wait(lock, [this]() { return stopping || pending; });
+      if (!pending)
+        break;
 
-    os << "]";
+      // Newer frames submitted meanwhile replace this one
+      frame_available.wait_until(lock, last_frame + min_interval,
+                                 [this]() { return stopping; });
 
-    return os.str();
+      DrawFunction draw{std::move(pending)};
+      pending = nullptr;
+      drawing = true;
+      lock.unlock();
+
+      last_frame = clock::now();
+      bool drawn{true};
+      try {
+        draw(plt);
+      } catch (...) {
+        // Forget whatever the function added before throwing
+        plt.reset();
+        drawn = false;
+      }
+
+      bool shown{false}, alive{true};
+      if (drawn) {
+        shown = plt.show();
+        if (shown) {
+          // Do not send the next frame before Gnuplot has drawn this
+          // one; this fails at once with backends that do not support it
+          plt.sync(SYNC_TIMEOUT_MS);
+        } else {
+          plt.reset();
+          alive = plt.ok() || plt.restart();
+        }
+      }
+
+      lock.lock();
+      drawing = false;
+      if (!drawn)
+        ++counters.failed;
+      else
+        ++(shown ? counters.rendered : counters.lost);
+
+      if (!alive) {
+        // Nobody is going to draw the frames submitted from now on
+        broken = true;
+        if (pending) {
+          pending = nullptr;
+          ++counters.dropped;
+        }
+        frame_done.notify_all();
+        break;
+      }
+      frame_done.notify_all();
+    }
   }
 
-  FILE *connection;
-  std::vector<GnuplotSeries> series;
-  std::vector<std::string> files_to_delete;
-  std::string xrange;
-  std::string yrange;
-  std::string zrange;
-  bool is_3dplot;
+  Gnuplot plt;
+  mutable std::mutex mutex{};
+  std::condition_variable frame_available{};
+  std::condition_variable frame_done{};
+  DrawFunction pending{};
+  bool drawing{false};
+  bool stopping{false};
+  bool broken{false};
+  clock::duration min_interval{};
+  Counters counters{};
+  std::thread worker{};
 };
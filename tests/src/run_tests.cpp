@@ -2,15 +2,30 @@
 #include "doctest.h"
 
 DOCTEST_MAKE_STD_HEADERS_CLEAN_FROM_WARNINGS_ON_WALL_BEGIN
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 DOCTEST_MAKE_STD_HEADERS_CLEAN_FROM_WARNINGS_ON_WALL_END
 
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 #include "gplot++.h"
 
 using namespace std;
@@ -34,10 +49,6 @@ string read_file(const string & file_name) {
     return result;
 }
 
-// This is useful to make the program wait until Gnuplot finishes
-// writing stuff on the "dumb" terminal
-void wait() { std::this_thread::sleep_for(std::chrono::milliseconds(1000)); }
-
 TEST_CASE("complex") {
   const string file_name{"complex.svg"};
   
@@ -56,8 +67,6 @@ TEST_CASE("complex") {
         plt.show();
     }  // Call Gnuplot::~Gnuplot() for plt and save the file
 
-    wait();
-
     string file_contents{read_file(file_name)};
 
 	CHECK(file_contents.find("Series #1") != string::npos);
@@ -66,6 +75,19 @@ TEST_CASE("complex") {
 	CHECK(file_contents.find("Y axis") != string::npos);
 }
 
+TEST_CASE("dumb terminal") {
+  const string file_name{"dumb_terminal.gp"};
+
+  {
+    // Use `cat` instead of Gnuplot to save the commands in a file
+    Gnuplot plt{("cat > " + file_name).c_str(), false};
+    plt.redirect_to_dumb("", 100, 40, Gnuplot::TerminalMode::ANSI);
+  }
+
+  CHECK(read_file(file_name).find("set terminal dumb size 100 40 ansi") !=
+        string::npos);
+}
+
 TEST_CASE("animation") {
   const string file_name{"animation.gif"};
 
@@ -88,8 +110,1257 @@ TEST_CASE("animation") {
 	}
   }
 
-  wait();
-
   // No checks, just try to compile the code above and verify that no
   // errors are issued
 }
+
+#ifndef _WIN32
+TEST_CASE("sync") {
+  const string file_name{"sync.svg"};
+
+  Gnuplot plt{};
+
+  plt.redirect_to_svg(file_name);
+
+  vector<double> x{1, 2, 3, 4, 5};
+  plt.plot(x, x, "Synchronized series");
+  plt.set_xlabel("X axis");
+  plt.show();
+
+  // Once `sync` returns, the plot must be in the file even if Gnuplot
+  // is still running
+  REQUIRE(plt.sync());
+  CHECK(plt.sync());
+
+  string file_contents{read_file(file_name)};
+  CHECK(file_contents.find("Synchronized series") != string::npos);
+}
+#endif
+
+TEST_CASE("pool") {
+  GnuplotPool pool{1};
+  REQUIRE(pool.num_of_idle_processes() == 1);
+
+  vector<double> x{1, 2, 3, 4, 5};
+  {
+    Gnuplot plt{pool.lease()};
+    CHECK(plt.ok());
+    CHECK(pool.num_of_idle_processes() == 0);
+
+    plt.redirect_to_svg("pool1.svg");
+    plt.set_xlabel("First lease");
+    plt.plot(x, x);
+    plt.show();
+
+    // Moving the object must not give the process back to the pool
+    Gnuplot other{std::move(plt)};
+    CHECK(other.ok());
+    CHECK(pool.num_of_idle_processes() == 0);
+  }
+
+  // The process is back, and the output file has been completed
+  CHECK(pool.num_of_idle_processes() == 1);
+  CHECK(read_file("pool1.svg").find("First lease") != string::npos);
+
+  {
+    Gnuplot plt{pool};
+    plt.redirect_to_svg("pool2.svg");
+    plt.plot(x, x);
+    plt.show();
+  }
+
+  // The session was reset, so the label of the first lease is gone
+  CHECK(read_file("pool2.svg").find("First lease") == string::npos);
+
+  // Containers of `Gnuplot` objects move them instead of copying
+  static_assert(is_nothrow_move_constructible<Gnuplot>::value, "");
+  static_assert(is_nothrow_move_assignable<Gnuplot>::value, "");
+
+  {
+    // Assigning to a leased object must give its process back at once
+    Gnuplot plt{pool};
+    CHECK(pool.num_of_idle_processes() == 0);
+    plt = Gnuplot{make_unique<GnuplotNullBackend>()};
+    CHECK(pool.num_of_idle_processes() == 1);
+    CHECK(plt.ok());
+  }
+
+#ifndef _WIN32
+  // Temporary redirections must not change the terminal of the next lease
+  auto current_terminal = [](Gnuplot &plt) {
+    remove("terminal.txt");
+    plt.sendcommand("set print 'terminal.txt'\nprint GPVAL_TERM\nset print");
+    REQUIRE(plt.sync(10000));
+    return read_file("terminal.txt");
+  };
+
+  string default_terminal;
+  {
+    Gnuplot plt{pool};
+    default_terminal = current_terminal(plt);
+    plt.redirect_to_png("pool3.png");
+    const string png_terminal{current_terminal(plt)};
+    CHECK(png_terminal != default_terminal);
+
+    plt.plot(x, x);
+    string buffer;
+    REQUIRE(plt.render_to_buffer(buffer, Gnuplot::OutputFormat::SVG));
+    CHECK(current_terminal(plt) == png_terminal);
+  }
+  {
+    Gnuplot plt{pool};
+    CHECK(current_terminal(plt) == default_terminal);
+  }
+#endif
+}
+
+TEST_CASE("batch") {
+  vector<double> x{1, 2, 3, 4, 5};
+  vector<string> completed;
+  int num_of_failures{};
+  mutex completed_mutex;
+
+  {
+    GnuplotBatch batch{2};
+    CHECK(batch.num_of_workers() == 2);
+
+    for (int i{}; i < 6; ++i) {
+      string file_name{"batch" + to_string(i) + ".svg"};
+      batch.submit(
+          file_name,
+          [&x, i](Gnuplot &plt) {
+            plt.plot(x, x, "Batch job #" + to_string(i));
+          },
+          i % 3, [&](const string &output, bool success) {
+            lock_guard<mutex> lock{completed_mutex};
+            completed.push_back(output);
+            if (!success)
+              ++num_of_failures;
+          });
+    }
+
+    batch.wait();
+    CHECK(completed.size() == 6);
+    CHECK(num_of_failures == 0);
+  }
+
+  for (int i{}; i < 6; ++i) {
+    string file_contents{read_file("batch" + to_string(i) + ".svg")};
+    CHECK(file_contents.find("Batch job #" + to_string(i)) != string::npos);
+  }
+
+  SUBCASE("size of dumb plots") {
+    {
+      GnuplotBatch batch{1};
+      GnuplotBatch::Job job{"batch_dumb.txt",
+                            [&x](Gnuplot &plt) { plt.plot(x, x); }};
+      job.size = "60,20";
+      batch.submit(std::move(job));
+    }
+
+    ifstream file{"batch_dumb.txt"};
+    string line;
+    size_t num_of_lines{}, max_width{};
+    while (getline(file, line)) {
+      ++num_of_lines;
+      max_width = max(max_width, line.size());
+    }
+    CHECK(num_of_lines > 0);
+    CHECK(max_width <= 60);
+  }
+}
+
+TEST_CASE("batch priorities and failures") {
+  vector<double> x{1, 2, 3};
+  promise<void> release_first, release_second;
+  shared_future<void> first{release_first.get_future()};
+  shared_future<void> second{release_second.get_future()};
+  vector<int> order;
+  vector<string> failed;
+  mutex m;
+
+  GnuplotBatch batch{2};
+  // Keep both workers busy until all the jobs have been queued
+  batch.submit("batch_gate0.txt", [first](Gnuplot &) { first.wait(); });
+  batch.submit("batch_gate1.txt", [second](Gnuplot &) { second.wait(); });
+
+  // The only free worker must run the queued jobs by priority
+  for (int priority : {0, 1, 2, 3}) {
+    batch.submit(
+        "batch_priority" + to_string(priority) + ".txt",
+        [&x, priority, &m, &order](Gnuplot &plt) {
+          {
+            lock_guard<mutex> lock{m};
+            order.push_back(priority);
+          }
+          plt.plot(x, x);
+        },
+        priority);
+  }
+
+  // An exception thrown while drawing makes the job fail
+  batch.submit(
+      "batch_throw.txt",
+      [](Gnuplot &) { throw runtime_error("Drawing failed"); }, -1,
+      [&](const string &output, bool success) {
+        lock_guard<mutex> lock{m};
+        if (!success)
+          failed.push_back(output);
+      });
+
+  release_second.set_value();
+  for (int i{}; i < 1000; ++i) {
+    {
+      lock_guard<mutex> lock{m};
+      if (order.size() == 4)
+        break;
+    }
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  {
+    lock_guard<mutex> lock{m};
+    CHECK(order == vector<int>{3, 2, 1, 0});
+  }
+
+  release_first.set_value();
+  batch.wait();
+  CHECK(failed == vector<string>{"batch_throw.txt"});
+}
+
+TEST_CASE("parallel animation") {
+  GnuplotAnimationRenderer renderer{2};
+  renderer.set_xrange(0, 6);
+  renderer.set_yrange(0, 6);
+
+  vector<double> x{1, 2, 3, 4, 5}, y{5, 2, 4, 1, 3};
+  bool result = renderer.render(
+      x.size(),
+      [&](Gnuplot &plt, size_t frame) {
+        vector<double> frame_x(x.begin(), x.begin() + frame + 1);
+        vector<double> frame_y(y.begin(), y.begin() + frame + 1);
+        plt.plot(frame_x, frame_y, "Frame #" + to_string(frame));
+      },
+      "parallel_frame_%03d.png");
+  CHECK(result);
+
+  for (size_t i{}; i < x.size(); ++i) {
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "parallel_frame_%03d.png",
+             static_cast<int>(i));
+    // The frames are PNG images, so we can only check that they exist
+    CHECK(!read_file(file_name).empty());
+  }
+
+  CHECK(renderer.assemble_gif("parallel_animation.gif"));
+}
+
+TEST_CASE("parallel animation with computed ranges") {
+  GnuplotAnimationRenderer renderer{2};
+  const auto draw = [](Gnuplot &plt, size_t frame) {
+    plt.plot(vector<double>{0.0, 1.0 * frame}, "Frame #" + to_string(frame));
+  };
+
+  // Patterns must contain exactly one integer conversion
+  CHECK(!renderer.render(2, draw, "bad_frame.png"));
+  CHECK(!renderer.render(2, draw, "bad_frame_%s.png"));
+  CHECK(!renderer.render(2, draw, "bad_frame_%d_%d.png"));
+
+  // No range is set, so `draw` is called in advance to compute them
+  CHECK(renderer.render(3, draw, "ranged_frame_100%%_%02d.png"));
+  for (const auto &name :
+       {"ranged_frame_100%_00.png", "ranged_frame_100%_01.png",
+        "ranged_frame_100%_02.png"})
+    CHECK(!read_file(name).empty());
+}
+
+TEST_CASE("frames") {
+  const string file_name{"frames.gif"};
+
+  {
+    Gnuplot plt{};
+    plt.redirect_to_animated_gif(file_name);
+
+    vector<double> x{1, 2, 3, 4, 5};
+    vector<double> y{5, 4, 3, 2, 1};
+
+    for (int i{}; i < (int)x.size(); ++i) {
+      plt.add_point(x[i], y[i]);
+      plt.plot("Moving point");
+      plt.set_xrange(0, 6);
+      plt.set_yrange(0, 6);
+      plt.next_frame();
+    }
+
+    CHECK(plt.get_num_of_frames() == x.size());
+    CHECK(plt.show_frames());
+    CHECK(plt.get_num_of_frames() == 0);
+  }
+
+  CHECK(!read_file(file_name).empty());
+}
+
+TEST_CASE("pipelined animation") {
+  const string file_name{"pipelined.gp"};
+  const size_t num_of_frames{50};
+
+  {
+    // Use `cat` instead of Gnuplot to save the commands in a file
+    Gnuplot plt{("cat > " + file_name).c_str(), false};
+    GnuplotAnimationBuilder builder{4, 3};
+
+    auto produce = [](Gnuplot &frame_plt, size_t frame) {
+      // Make the workers finish in random order
+      this_thread::sleep_for(chrono::microseconds((frame * 7919) % 500));
+
+      frame_plt.set_title("Frame " + to_string(frame) + ";");
+      vector<double> x{1, 2, 3};
+      frame_plt.plot(x, x);
+    };
+
+    bool result = builder.run(plt, num_of_frames, produce);
+    CHECK(result);
+
+    // Each frame is accounted for as a call to `show()`
+#ifndef GNUPLOTPP_DISABLE_STATS
+    CHECK(plt.get_stats().num_of_shows == num_of_frames);
+    CHECK(plt.get_stats().num_of_series == num_of_frames);
+    CHECK(plt.get_stats().num_of_points == 3 * num_of_frames);
+#endif
+  }
+
+  // Frames must be written in the same order as they were produced
+  string commands{read_file(file_name)};
+  size_t last_pos{};
+  for (size_t frame{}; frame < num_of_frames; ++frame) {
+    size_t pos = commands.find("Frame " + to_string(frame) + ";");
+    REQUIRE(pos != string::npos);
+    CHECK(pos >= last_pos);
+    last_pos = pos;
+  }
+}
+
+TEST_CASE("pipelined animation with a failing frame") {
+  Gnuplot plt{make_unique<GnuplotNullBackend>()};
+  GnuplotAnimationBuilder builder{4, 3};
+
+  atomic<size_t> num_of_calls{};
+  bool result = builder.run(plt, 50, [&](Gnuplot &frame_plt, size_t frame) {
+    ++num_of_calls;
+    if (frame == 10)
+      throw runtime_error("Frame failed");
+    frame_plt.plot(vector<double>{1, 2, 3});
+  });
+
+  // The exception must neither terminate the program nor hang `run`
+  CHECK(!result);
+  CHECK(num_of_calls < 50);
+}
+
+#ifndef _WIN32
+TEST_CASE("render to buffer") {
+  Gnuplot plt{};
+
+  vector<double> x{1, 2, 3, 4, 5};
+  plt.plot(x, x, "In-memory series");
+
+  string buffer;
+  REQUIRE(plt.render_to_buffer(buffer, Gnuplot::OutputFormat::SVG));
+  CHECK(buffer.find("In-memory series") != string::npos);
+
+  // Nothing to plot
+  CHECK(!plt.render_to_buffer(buffer, Gnuplot::OutputFormat::SVG));
+  CHECK(buffer.empty());
+
+  // The pipe must be able to carry images larger than its buffer
+  vector<double> y(50000);
+  for (size_t i{}; i < y.size(); ++i)
+    y[i] = static_cast<double>(i % 100);
+  plt.plot(y, "Large plot");
+  REQUIRE(plt.render_to_buffer(buffer, Gnuplot::OutputFormat::SVG));
+  CHECK(buffer.size() > 65536);
+
+  SUBCASE("timeout") {
+    // Gnuplot starts too late for the first call
+    Gnuplot slow{"sh -c 'sleep 1; exec gnuplot'", false};
+    slow.plot(x, x, "Late series");
+    CHECK(!slow.render_to_buffer(buffer, Gnuplot::OutputFormat::SVG, "", 50));
+    CHECK(buffer.empty());
+
+    // The late image must not end up in the next buffer
+    slow.plot(x, x, "Next series");
+    REQUIRE(slow.render_to_buffer(buffer, Gnuplot::OutputFormat::SVG));
+    CHECK(buffer.find("Next series") != string::npos);
+    CHECK(buffer.find("Late series") == string::npos);
+  }
+}
+#endif
+
+TEST_CASE("fan-out") {
+  Gnuplot plt{};
+
+  vector<double> x{1, 2, 3, 4, 5};
+  plt.plot(x, x, "Fan-out series");
+
+  REQUIRE(plt.show_to({
+      {Gnuplot::OutputFormat::SVG, "fanout.svg"},
+      {Gnuplot::OutputFormat::SVG, "fanout-small.svg", "320,200"},
+      {Gnuplot::OutputFormat::DUMB, "fanout.txt"},
+  }));
+#ifndef _WIN32
+  REQUIRE(plt.sync());
+
+  CHECK(read_file("fanout.svg").find("Fan-out series") != string::npos);
+  CHECK(read_file("fanout-small.svg").find("Fan-out series") != string::npos);
+  CHECK(read_file("fanout.txt").find("Fan-out series") != string::npos);
+#endif
+}
+
+TEST_CASE("point producers") {
+  const int num_of_threads{4};
+  const int num_of_points{5000};
+  Gnuplot plt{make_unique<GnuplotNullBackend>()};
+
+  auto produce = [&](bool interleaved) {
+    vector<thread> threads{};
+    for (int t{}; t < num_of_threads; ++t) {
+      auto producer = plt.make_point_producer();
+      threads.emplace_back([=]() mutable {
+        for (int i{}; i < num_of_points; ++i) {
+          // With `interleaved`, X is a timestamp shared by all threads
+          const int x{interleaved ? i * num_of_threads + t : i};
+          producer.add_point(x, t);
+        }
+      });
+    }
+    for (auto &th : threads)
+      th.join();
+  };
+
+  SUBCASE("arrival") {
+    plt.set_point_order(Gnuplot::PointOrder::ARRIVAL);
+    produce(false);
+    CHECK(plt.drain_points() == num_of_threads * num_of_points);
+    CHECK(plt.drain_points() == 0);
+
+    // The points of each thread must keep their order
+    vector<double> last(num_of_threads, -1);
+    const auto &x = plt.get_points_x();
+    const auto &y = plt.get_points_y();
+    bool ordered{true};
+    for (size_t i{}; i < x.size(); ++i) {
+      const auto t = static_cast<size_t>(y[i]);
+      ordered = ordered && x[i] > last[t];
+      last[t] = x[i];
+    }
+    CHECK(ordered);
+  }
+
+  SUBCASE("timestamp") {
+    // This is the default
+    produce(true);
+
+    plt.plot("Producers");
+    const auto &x = plt.get_points_x();
+    REQUIRE(x.size() == num_of_threads * num_of_points);
+    CHECK(is_sorted(x.begin(), x.end()));
+    CHECK(plt.show());
+  }
+}
+
+TEST_CASE("point ring") {
+  SUBCASE("full") {
+    GnuplotPointRing ring{3};
+    REQUIRE(ring.capacity() == 4);
+
+    int pushed{};
+    for (int i{}; i < 6; ++i)
+      pushed += ring.try_push(i, i) ? 1 : 0;
+    CHECK(pushed == 4);
+    CHECK(ring.num_of_dropped() == 2);
+    CHECK(ring.size() == 4);
+
+    Gnuplot plt{make_unique<GnuplotNullBackend>()};
+    CHECK(plt.add_points(ring, 3) == 3);
+    CHECK(ring.try_push(10, 10));
+    CHECK(plt.add_points(ring) == 2);
+    CHECK(plt.get_points_x() == vector<double>{0, 1, 2, 3, 10});
+  }
+
+  SUBCASE("two threads") {
+    const int num_of_points{200000};
+    GnuplotPointRing ring{1000};
+    Gnuplot plt{make_unique<GnuplotNullBackend>()};
+
+    atomic<bool> done{false};
+    thread producer{[&]() {
+      for (int i{}; i < num_of_points; ++i)
+        ring.try_push(i, -i);
+      done = true;
+    }};
+
+    while (!done)
+      plt.add_points(ring);
+    producer.join();
+    plt.add_points(ring);
+
+    const auto &x = plt.get_points_x();
+    CHECK(x.size() + ring.num_of_dropped() == num_of_points);
+    CHECK(is_sorted(x.begin(), x.end()));
+    CHECK(adjacent_find(x.begin(), x.end()) == x.end());
+  }
+}
+
+TEST_CASE("live view") {
+  vector<double> x{1, 2, 3};
+
+  SUBCASE("latest frame wins") {
+    Gnuplot plt{"gnuplot", false};
+    REQUIRE(plt.redirect_to_dumb("live.txt"));
+
+    const int num_of_frames{100};
+    {
+      GnuplotLiveView view{std::move(plt), 0};
+      for (int i{}; i < num_of_frames; ++i) {
+        view.submit([i, &x](Gnuplot &frame) {
+          frame.plot(x, x, "Frame " + to_string(i));
+        });
+      }
+      view.flush();
+
+      const auto counters = view.get_counters();
+      CHECK(counters.submitted == num_of_frames);
+      CHECK(counters.rendered >= 1);
+      CHECK(counters.rendered + counters.dropped == num_of_frames);
+    }
+
+    CHECK(read_file("live.txt").find("Frame 99") != string::npos);
+  }
+
+  SUBCASE("failing frame") {
+    GnuplotLiveView view{Gnuplot{make_unique<GnuplotNullBackend>()}, 0};
+    view.submit([](Gnuplot &) { throw runtime_error("Frame failed"); });
+    view.flush();
+    view.submit([&x](Gnuplot &frame) { frame.plot(x); });
+    view.flush();
+
+    // The thread must survive the exception
+    const auto counters = view.get_counters();
+    CHECK(counters.failed == 1);
+    CHECK(counters.rendered == 1);
+  }
+
+#ifndef _WIN32
+  SUBCASE("Gnuplot quits") {
+    Gnuplot plt{"gnuplot", false};
+    const int pid = plt.get_pid();
+    REQUIRE(pid > 0);
+
+    GnuplotLiveView view{std::move(plt), 0};
+    view.submit([&x](Gnuplot &frame) { frame.plot(x); });
+    view.flush();
+    kill(pid, SIGKILL);
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    // The frame is lost, but Gnuplot is restarted for the next one
+    view.submit([&x](Gnuplot &frame) { frame.plot(x); });
+    view.flush();
+    view.submit([&x](Gnuplot &frame) { frame.plot(x); });
+    view.flush();
+    CHECK(view.ok());
+    auto counters = view.get_counters();
+    CHECK(counters.lost == 1);
+    CHECK(counters.rendered == 2);
+  }
+
+  SUBCASE("Gnuplot cannot be restarted") {
+    // This backend does not know how to start Gnuplot again
+    Gnuplot plt{make_unique<GnuplotProcessBackend>("true")};
+    for (int i{}; i < 500 && plt.ok(); ++i)
+      this_thread::sleep_for(chrono::milliseconds(10));
+
+    GnuplotLiveView view{std::move(plt), 0};
+    view.submit([&x](Gnuplot &frame) { frame.plot(x); });
+    view.flush();
+    CHECK(!view.ok());
+
+    // Frames are refused, and waiting for them must not block
+    CHECK(!view.submit([&x](Gnuplot &frame) { frame.plot(x); }));
+    view.flush();
+    const auto counters = view.get_counters();
+    CHECK(counters.submitted == 2);
+    CHECK(counters.lost == 1);
+    CHECK(counters.dropped == 1);
+    CHECK(counters.rendered == 0);
+  }
+#endif
+
+  SUBCASE("rate limit") {
+    GnuplotLiveView view{Gnuplot{make_unique<GnuplotNullBackend>()}, 10};
+    const auto start = chrono::steady_clock::now();
+    while (chrono::steady_clock::now() - start < chrono::milliseconds(300)) {
+      view.submit([&x](Gnuplot &frame) { frame.plot(x); });
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    view.flush();
+
+    // One frame at once, then at most one every 100 ms
+    const auto counters = view.get_counters();
+    CHECK(counters.rendered >= 2);
+    CHECK(counters.rendered <= 5);
+    CHECK(counters.dropped > 0);
+  }
+}
+
+TEST_CASE("stats") {
+  auto backend = make_unique<GnuplotNullBackend>();
+  GnuplotNullBackend &null = *backend;
+  Gnuplot plt{std::move(backend)};
+  plt.reset_stats();
+  null.reset();
+
+  int num_of_calls{};
+  Gnuplot::Stats last_from_callback{};
+  plt.set_stats_callback([&](const Gnuplot::Stats &last,
+                             const Gnuplot::Stats &) {
+    ++num_of_calls;
+    last_from_callback = last;
+  });
+
+  vector<double> x{1, 2, 3};
+  plt.plot(x, x);
+  plt.histogram(vector<double>{1, 2, 2, 3}, 2);
+  plt.show();
+
+  const Gnuplot::Stats &last = plt.get_last_show_stats();
+#ifndef GNUPLOTPP_DISABLE_STATS
+  CHECK(num_of_calls == 1);
+  CHECK(last_from_callback.bytes_written == last.bytes_written);
+  CHECK(last.num_of_shows == 1);
+  CHECK(last.num_of_series == 2);
+  CHECK(last.num_of_points == 5);
+  CHECK(last.bytes_written == null.total_bytes());
+  CHECK(last.num_of_flushes == null.num_of_flushes());
+  CHECK(last.peak_buffered_bytes >=
+        null.bytes(GnuplotBackend::Channel::DATA));
+  CHECK(last.serialization_time >= 0.0);
+
+  plt.plot(x, x);
+  plt.show();
+  CHECK(plt.get_stats().num_of_shows == 2);
+  CHECK(plt.get_stats().num_of_points == 8);
+  CHECK(plt.get_stats().bytes_written == null.total_bytes());
+#endif
+}
+
+TEST_CASE("trace") {
+  {
+    auto tracer = make_shared<GnuplotTracer>("trace.json");
+    REQUIRE(tracer->ok());
+    GnuplotTracer::set_global(tracer);
+
+    Gnuplot plt{};
+    GnuplotTracer::set_global(nullptr);
+
+    plt.plot(vector<double>{1, 2, 3});
+    plt.show();
+
+    // Spans from another thread must get a different id
+    thread other{[&]() { GnuplotTracer::Span span{tracer.get(), "other"}; }};
+    other.join();
+  }
+
+  const string trace = read_file("trace.json");
+  REQUIRE(trace.size() > 2);
+  CHECK(trace.front() == '[');
+  CHECK(trace.rfind(']') > trace.rfind('}'));
+
+  for (const char *name : {"spawn", "plot", "show", "send_data",
+                           "sendcommand", "close", "other"}) {
+    CHECK_MESSAGE(trace.find(string{"\"name\":\""} + name + "\"") !=
+                      string::npos,
+                  name);
+  }
+  CHECK(trace.find("\"tid\":1,") != string::npos);
+  CHECK(trace.find("\"tid\":2,") != string::npos);
+}
+
+#ifndef _WIN32
+TEST_CASE("latency") {
+  Gnuplot plt{};
+  CHECK(plt.get_latency().count == 0);
+  REQUIRE(plt.enable_latency_probe());
+
+  vector<double> x{1, 2, 3};
+  for (int i{}; i < 5; ++i) {
+    plt.plot(x, x);
+    plt.show();
+  }
+
+  // Malformed acknowledgements must be ignored
+  for (const char *seq : {"", "oops", "-1", "12x", "99999999999999999999999"})
+    REQUIRE(plt.sendcommand("set print '/dev/fd/3'\nprint 'GPLOTPP_ACK " +
+                            string{seq} + "'\nset print"));
+
+  // The acknowledgements are printed before the sentinel
+  REQUIRE(plt.sync(10000));
+
+  Gnuplot::Latency latency = plt.get_latency();
+  CHECK(latency.count == 5);
+  CHECK(latency.pending == 0);
+  CHECK(latency.lost == 0);
+  CHECK(latency.p50 > 0.0);
+  CHECK(latency.p50 <= latency.p99);
+  CHECK(latency.p99 <= latency.max);
+
+  // Backends that cannot read from Gnuplot do not support this
+  Gnuplot buffered{make_unique<GnuplotBufferBackend>()};
+  CHECK(!buffered.enable_latency_probe());
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("resources") {
+  Gnuplot plt{};
+  REQUIRE(plt.get_pid() > 0);
+  REQUIRE(plt.sync(10000)); // Make sure that Gnuplot is up and running
+
+  GnuplotResourceUsage usage{};
+  REQUIRE(plt.get_resource_usage(usage));
+  CHECK(usage.rss_bytes > 0);
+  CHECK(usage.cpu_time >= 0.0);
+  CHECK(usage.state != '\0');
+
+  // Any process uses more than one byte, so the callback must fire
+  mutex m;
+  condition_variable cv;
+  int num_of_calls{};
+  GnuplotResourceLimits limits{};
+  limits.max_rss_bytes = 1;
+  REQUIRE(plt.monitor_resources(
+      limits,
+      [&](const GnuplotResourceUsage &) {
+        lock_guard<mutex> lock{m};
+        ++num_of_calls;
+        cv.notify_all();
+      },
+      chrono::milliseconds(10)));
+
+  {
+    unique_lock<mutex> lock{m};
+    CHECK(cv.wait_for(lock, chrono::seconds(5),
+                      [&]() { return num_of_calls > 0; }));
+  }
+
+  // It is called again only after going back below the limits
+  this_thread::sleep_for(chrono::milliseconds(50));
+  lock_guard<mutex> lock{m};
+  CHECK(num_of_calls == 1);
+  CHECK(plt.get_resource_monitor()->last_usage().rss_bytes > 0);
+}
+#endif
+
+#ifndef _WIN32
+TEST_CASE("health") {
+  SUBCASE("SIGPIPE") {
+    // The process is alive, but it does not read its input
+    Gnuplot plt{"sleep 10 <&-", false};
+    const int pid = plt.get_pid();
+    REQUIRE(pid > 0);
+
+    // Without protection, this would kill the test program
+    string long_title(100000, 'a');
+    CHECK(!plt.set_title(long_title));
+    CHECK(!plt.ok());
+
+    kill(pid, SIGKILL);
+  }
+
+  SUBCASE("restart") {
+    Gnuplot plt{"gnuplot", false};
+    plt.enable_auto_restart();
+    REQUIRE(plt.redirect_to_dumb("restart.txt"));
+    REQUIRE(plt.set_title("Restarted"));
+
+    const int old_pid = plt.get_pid();
+    REQUIRE(old_pid > 0);
+    kill(old_pid, SIGKILL);
+
+    // Liveness detection must not block
+    for (int i{}; i < 500 && plt.ok(); ++i)
+      this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(!plt.ok());
+
+    plt.plot(vector<double>{1, 2, 3});
+    REQUIRE(plt.show());
+    CHECK(plt.ok());
+    CHECK(plt.get_num_of_restarts() == 1);
+    CHECK(plt.get_pid() != old_pid);
+
+    REQUIRE(plt.sync(10000));
+    CHECK(read_file("restart.txt").find("Restarted") != string::npos);
+  }
+}
+#endif
+
+#ifdef __linux__
+TEST_CASE("launch options") {
+  GnuplotLaunchOptions options{};
+  options.nice = 5;
+  options.cpus = {0};
+  options.io_class = GnuplotLaunchOptions::IoClass::BEST_EFFORT;
+  options.io_level = 7;
+  options.max_address_space = size_t{8} << 30;
+
+  auto backend = make_unique<GnuplotProcessBackend>("gnuplot", options);
+  CHECK(backend->launch_options_applied());
+  const pid_t pid = backend->pid();
+  REQUIRE(pid > 0);
+
+  errno = 0;
+  CHECK(getpriority(PRIO_PROCESS, static_cast<id_t>(pid)) == 5);
+
+  cpu_set_t set;
+  REQUIRE(sched_getaffinity(pid, sizeof(set), &set) == 0);
+  CHECK(CPU_COUNT(&set) == 1);
+  CHECK(CPU_ISSET(0, &set));
+
+  rlimit limit{};
+  REQUIRE(prlimit(pid, RLIMIT_AS, nullptr, &limit) == 0);
+  CHECK(limit.rlim_cur == (rlim_t{8} << 30));
+
+  // IOPRIO_WHO_PROCESS = 1, class in the upper bits
+  CHECK(syscall(SYS_ioprio_get, 1, pid) == ((2 << 13) | 7));
+}
+#endif
+
+#ifndef _WIN32
+TEST_CASE("deferred startup") {
+  vector<double> x{1, 2, 3};
+  GnuplotLaunchOptions options{};
+
+  SUBCASE("lazy") {
+    options.startup = GnuplotLaunchOptions::Startup::LAZY;
+    Gnuplot plt{"gnuplot", false, options};
+
+    REQUIRE(plt.ok());
+    CHECK(!plt.started());
+    CHECK(plt.get_pid() == -1);
+
+    // Neither settings nor `sync` need the process
+    plt.set_title("Lazy");
+    plt.set_xlabel("x");
+    CHECK(plt.sync());
+    CHECK(!plt.started());
+
+    plt.plot(x, x);
+    CHECK(!plt.started());
+    CHECK(plt.show());
+    CHECK(plt.started());
+    CHECK(plt.get_pid() > 0);
+    CHECK(plt.sync(10000));
+  }
+
+  SUBCASE("background") {
+    options.startup = GnuplotLaunchOptions::Startup::BACKGROUND;
+    Gnuplot plt{"gnuplot", false, options};
+
+    REQUIRE(plt.ok());
+    plt.set_title("Background");
+    plt.plot(x, x);
+    CHECK(plt.show());
+    // This waits for the launch, if it has not completed yet
+    CHECK(plt.sync(10000));
+    CHECK(plt.started());
+    CHECK(plt.get_pid() > 0);
+  }
+
+  SUBCASE("background with buffered commands") {
+    options.startup = GnuplotLaunchOptions::Startup::BACKGROUND;
+    Gnuplot plt{"gnuplot", false, options};
+
+    // None of these waits for Gnuplot, and they must arrive in order
+    REQUIRE(plt.redirect_to_dumb("background.txt"));
+    REQUIRE(plt.set_title("Overridden"));
+    REQUIRE(plt.sendcommand("set title 'Raw title'"));
+    plt.plot(x, x);
+    REQUIRE(plt.show());
+
+    CHECK(plt.sync(10000));
+    CHECK(plt.started());
+    const string contents{read_file("background.txt")};
+    CHECK(contents.find("Raw title") != string::npos);
+    CHECK(contents.find("Overridden") == string::npos);
+  }
+
+  SUBCASE("never started") {
+    options.startup = GnuplotLaunchOptions::Startup::BACKGROUND;
+    Gnuplot plt{"gnuplot", false, options};
+    CHECK(plt.ok());
+    // The destructor waits for the launch and closes Gnuplot
+  }
+}
+#endif
+
+#ifndef _WIN32
+TEST_CASE("zygote") {
+  auto zygote = make_shared<GnuplotZygote>();
+  REQUIRE(zygote->running());
+  REQUIRE(zygote->pid() > 0);
+
+  SUBCASE("backend") {
+    auto backend = make_unique<GnuplotProcessBackend>(*zygote, "gnuplot");
+    GnuplotProcessBackend &process = *backend;
+    const int pid = process.pid();
+    REQUIRE(pid > 0);
+    CHECK(pid != zygote->pid());
+
+    Gnuplot plt{std::move(backend)};
+    REQUIRE(plt.redirect_to_dumb("zygote.txt"));
+    REQUIRE(plt.set_title("Zygote"));
+    plt.plot(vector<double>{1, 2, 3});
+    REQUIRE(plt.show());
+    REQUIRE(plt.sync(10000));
+    CHECK(read_file("zygote.txt").find("Zygote") != string::npos);
+
+    // The exit status comes from the zygote
+    kill(pid, SIGKILL);
+    for (int i{}; i < 500 && process.ok(); ++i)
+      this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(!process.ok());
+
+    int status{};
+    REQUIRE(process.exited(status));
+    CHECK(WIFSIGNALED(status));
+    CHECK(WTERMSIG(status) == SIGKILL);
+  }
+
+  SUBCASE("SIGPIPE") {
+    // The zygote ignores SIGPIPE, but its children must not
+    GnuplotProcessBackend process{*zygote, "sh -c 'kill -PIPE $$; sleep 10'"};
+    REQUIRE(process.pid() > 0);
+    for (int i{}; i < 500 && process.ok(); ++i)
+      this_thread::sleep_for(chrono::milliseconds(10));
+
+    int status{};
+    REQUIRE(process.exited(status));
+    CHECK(WIFSIGNALED(status));
+    CHECK(WTERMSIG(status) == SIGPIPE);
+  }
+
+  SUBCASE("global") {
+    GnuplotZygote::set_global(zygote);
+    {
+      Gnuplot plt{"gnuplot", false};
+      REQUIRE(plt.ok());
+      CHECK(plt.get_pid() > 0);
+      CHECK(plt.sync(10000));
+    }
+    GnuplotZygote::set_global(nullptr);
+  }
+}
+#endif
+
+#ifndef _WIN32
+TEST_CASE("daemon") {
+  const string socket_path{"gplotppd-test.sock"};
+  GnuplotDaemon daemon{socket_path, 1};
+  REQUIRE(daemon.ok());
+  thread server{[&daemon]() { daemon.run(); }};
+
+  SUBCASE("ring") {
+    GnuplotSharedRing writer{}, reader{};
+    REQUIRE(writer.create(8));
+    REQUIRE(reader.attach(dup(writer.fd())));
+    CHECK(reader.capacity() == 8);
+
+    string result{};
+    auto append = [&result](const char *buf, size_t size) {
+      result.append(buf, size);
+      return true;
+    };
+    CHECK(writer.write("abcdef", 6) == 6);
+    CHECK(writer.write("ghijkl", 6) == 2); // Full
+    CHECK(!reader.read(9, append));
+    CHECK(reader.read(5, append));
+    CHECK(writer.write("ijkl", 4) == 4); // Wraps around
+    CHECK(reader.read(7, append));
+    CHECK(result == "abcdefghijkl");
+  }
+
+  SUBCASE("plot") {
+    // A small ring, so that the client must wait for the daemon
+    Gnuplot plt{make_unique<GnuplotDaemonBackend>(socket_path, 256)};
+    REQUIRE(plt.ok());
+
+    vector<double> x(1000), y(1000);
+    for (size_t i{}; i < x.size(); ++i) {
+      x[i] = static_cast<double>(i);
+      y[i] = x[i] * x[i];
+    }
+
+    REQUIRE(plt.redirect_to_dumb("daemon.txt"));
+    REQUIRE(plt.set_title("Daemon"));
+    plt.plot(x, y);
+    REQUIRE(plt.show());
+    REQUIRE(plt.sync(10000));
+    CHECK(read_file("daemon.txt").find("Daemon") != string::npos);
+
+    plt.plot(x, y, "Through the daemon");
+    string svg;
+    REQUIRE(plt.render_to_buffer(svg, Gnuplot::OutputFormat::SVG));
+    CHECK(svg.find("Through the daemon") != string::npos);
+  }
+
+  SUBCASE("large output") {
+    Gnuplot plt{make_unique<GnuplotDaemonBackend>(socket_path)};
+    REQUIRE(plt.ok());
+
+    // The image is sent back in several messages
+    vector<double> y(500000);
+    for (size_t i{}; i < y.size(); ++i)
+      y[i] = static_cast<double>(i % 1000);
+    plt.plot(y, "Large output");
+    string svg;
+    REQUIRE(plt.render_to_buffer(svg, Gnuplot::OutputFormat::SVG));
+    CHECK(svg.size() > GnuplotDaemonProtocol::OUTPUT_CHUNK);
+    CHECK(svg.find("Large output") != string::npos);
+    CHECK(plt.sync(10000));
+  }
+
+  SUBCASE("many clients") {
+    vector<unique_ptr<Gnuplot>> plots{};
+    for (int i{}; i < 3; ++i)
+      plots.push_back(make_unique<Gnuplot>(
+          make_unique<GnuplotDaemonBackend>(socket_path)));
+
+    for (auto &plt : plots) {
+      REQUIRE(plt->ok());
+      CHECK(plt->sync(10000));
+    }
+    CHECK(daemon.num_of_clients() == 3);
+
+    plots.clear();
+    for (int i{}; i < 500 && daemon.num_of_clients() > 0; ++i)
+      this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(daemon.num_of_clients() == 0);
+  }
+
+  SUBCASE("no daemon") {
+    GnuplotDaemonBackend backend{"nonexistent.sock"};
+    CHECK(!backend.ok());
+  }
+
+  SUBCASE("path in use") {
+    // The running daemon must not lose its socket
+    GnuplotDaemon second{socket_path, 1};
+    CHECK(!second.ok());
+    Gnuplot plt{make_unique<GnuplotDaemonBackend>(socket_path)};
+    REQUIRE(plt.ok());
+    CHECK(plt.sync(10000));
+
+    // Only sockets can be replaced
+    const string file_name{"gplotppd-test.txt"};
+    FILE *file = fopen(file_name.c_str(), "w");
+    REQUIRE(file != nullptr);
+    fclose(file);
+    GnuplotDaemon third{file_name, 1};
+    CHECK(!third.ok());
+    CHECK(access(file_name.c_str(), F_OK) == 0);
+  }
+
+  SUBCASE("stale socket") {
+    // Leave behind a socket with nobody listening, like a crashed daemon
+    const string stale_path{"gplotppd-stale.sock"};
+    unlink(stale_path.c_str());
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    copy(stale_path.begin(), stale_path.end(), address.sun_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(bind(fd, reinterpret_cast<sockaddr *>(&address),
+                 sizeof(address)) == 0);
+    close(fd);
+
+    GnuplotDaemon replacement{stale_path, 1};
+    CHECK(replacement.ok());
+  }
+
+  SUBCASE("stop with clients") {
+    const string other_path{"gplotppd-stop.sock"};
+    auto other = make_unique<GnuplotDaemon>(other_path, 1);
+    REQUIRE(other->ok());
+    thread other_server{[&other]() { other->run(); }};
+
+    Gnuplot plt{make_unique<GnuplotDaemonBackend>(other_path)};
+    REQUIRE(plt.sync(10000));
+
+    // The client is still connected, but this must not block
+    other->stop();
+    other_server.join();
+    other.reset();
+    CHECK(!plt.sync(1000));
+  }
+
+  daemon.stop();
+  server.join();
+}
+#endif
+
+TEST_CASE("backends") {
+  vector<double> x{1, 2, 3};
+
+  SUBCASE("buffer") {
+    auto backend = make_unique<GnuplotBufferBackend>();
+    GnuplotBufferBackend &buffer = *backend;
+    Gnuplot plt{std::move(backend)};
+
+    REQUIRE(plt.ok());
+    CHECK(plt.get_backend() == &buffer);
+    CHECK(!plt.sync()); // Nothing is executed
+
+    buffer.clear();
+    plt.plot(x, x, "Buffered");
+    plt.show();
+
+    CHECK(buffer.str().find("$Datablock0 << EOD\n1 1 \n2 2 \n3 3 \n") !=
+          string::npos);
+    CHECK(buffer.str().find("title 'Buffered'") != string::npos);
+  }
+
+  SUBCASE("null") {
+    auto backend = make_unique<GnuplotNullBackend>();
+    GnuplotNullBackend &null = *backend;
+    Gnuplot plt{std::move(backend)};
+
+    REQUIRE(plt.ok());
+    CHECK(plt.sync());
+
+    null.reset();
+    CHECK(null.total_bytes() == 0);
+
+    plt.plot(x, x);
+    plt.show();
+
+    CHECK(null.bytes(GnuplotBackend::Channel::DATA) ==
+          string{"$Datablock0 << EOD\n1 1 \n2 2 \n3 3 \n\nEOD\n"}.size());
+    CHECK(null.bytes(GnuplotBackend::Channel::COMMAND) > 0);
+    CHECK(null.num_of_writes() >= 2);
+    CHECK(null.num_of_flushes() >= 1);
+    CHECK(null.elapsed() >= 0.0);
+  }
+
+  SUBCASE("recording") {
+    auto backend = make_unique<GnuplotRecordingBackend>();
+    GnuplotRecordingBackend &recording = *backend;
+    Gnuplot plt{std::move(backend)};
+
+    REQUIRE(plt.ok());
+    recording.clear();
+
+    plt.set_xlabel("X");
+    plt.plot(x, x, "Recorded");
+    plt.show();
+
+    CHECK(recording.str(GnuplotBackend::Channel::DATA) ==
+          "$Datablock0 << EOD\n1 1 \n2 2 \n3 3 \n\nEOD\n");
+
+    const auto &records = recording.get_records();
+    REQUIRE(!records.empty());
+    CHECK(records.front().channel == GnuplotBackend::Channel::COMMAND);
+    CHECK(records.front().bytes == "set xlabel 'X'");
+
+    const string commands = recording.str(GnuplotBackend::Channel::COMMAND);
+    CHECK(commands.find("title 'Recorded'") != string::npos);
+    CHECK(recording.str().size() ==
+          commands.size() +
+              recording.str(GnuplotBackend::Channel::DATA).size());
+  }
+
+  SUBCASE("session") {
+    string recorded{};
+    {
+      auto backend = make_unique<GnuplotRecordingBackend>();
+      GnuplotRecordingBackend &recording = *backend;
+      Gnuplot plt{make_unique<GnuplotSessionRecorder>("session.bin",
+                                                      std::move(backend))};
+      REQUIRE(plt.ok());
+
+      plt.plot(x, x, "Replayed");
+      plt.show();
+      CHECK(plt.sync());
+      recorded = recording.str();
+    }
+
+    GnuplotSessionReader reader{"session.bin"};
+    REQUIRE(reader.ok());
+
+    GnuplotSessionEvent event;
+    string replayed{};
+    int num_of_syncs{};
+    chrono::nanoseconds last_time{};
+    while (reader.next(event)) {
+      CHECK(event.time >= last_time);
+      last_time = event.time;
+
+      if (event.kind == GnuplotSessionEvent::Kind::COMMAND ||
+          event.kind == GnuplotSessionEvent::Kind::DATA)
+        replayed += event.bytes;
+      else if (event.kind == GnuplotSessionEvent::Kind::SYNC)
+        ++num_of_syncs;
+    }
+
+    CHECK(reader.ok());
+    CHECK(replayed == recorded);
+    CHECK(num_of_syncs == 1);
+  }
+
+  SUBCASE("script") {
+    {
+      Gnuplot plt{make_unique<GnuplotScriptBackend>("script.gp")};
+      REQUIRE(plt.ok());
+      plt.set_xlabel("Scripted");
+    }
+
+    CHECK(read_file("script.gp").find("set xlabel 'Scripted'") !=
+          string::npos);
+  }
+
+#ifndef _WIN32
+  SUBCASE("socket") {
+    const string path{"gplotpp-test.sock"};
+    unlink(path.c_str());
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    copy(path.begin(), path.end(), address.sun_path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    REQUIRE(server >= 0);
+    REQUIRE(::bind(server, reinterpret_cast<sockaddr *>(&address),
+                   sizeof(address)) == 0);
+    REQUIRE(listen(server, 1) == 0);
+
+    // Collect everything the client sends
+    string received;
+    thread reader{[&]() {
+      int client = accept(server, nullptr, nullptr);
+      char buf[256];
+      ssize_t count;
+      while ((count = read(client, buf, sizeof(buf))) > 0)
+        received.append(buf, static_cast<size_t>(count));
+      close(client);
+    }};
+
+    {
+      Gnuplot plt{make_unique<GnuplotSocketBackend>(path)};
+      CHECK(plt.ok());
+      plt.set_ylabel("Through a socket");
+    }
+
+    reader.join();
+    close(server);
+    unlink(path.c_str());
+
+    CHECK(received.find("set ylabel 'Through a socket'") != string::npos);
+  }
+#endif
+}
@@ -0,0 +1,167 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Replay a session saved by GnuplotSessionRecorder
+ *
+ * Usage: gplotpp-replay [--null] [--paced] [--exe GNUPLOT] FILE
+ *
+ * By default the session is sent to Gnuplot as fast as possible. With
+ * --paced, each event is sent at the same time it was recorded. With
+ * --null, nothing is executed: this measures the cost of the transport
+ * alone.
+ */
+
+#include "gplot++.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+using clock_type = std::chrono::steady_clock;
+
+static void print_usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--null] [--paced] [--exe GNUPLOT] FILE\n";
+}
+
+static std::unique_ptr<GnuplotBackend> make_backend(bool null_sink,
+                                                    const std::string &exe) {
+  if (null_sink)
+    return std::make_unique<GnuplotNullBackend>();
+
+#ifdef _WIN32
+  return std::make_unique<GnuplotPipeBackend>(exe);
+#else
+  return std::make_unique<GnuplotProcessBackend>(exe);
+#endif
+}
+
+static double seconds(clock_type::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+int main(int argc, char *argv[]) {
+  bool null_sink{false};
+  bool paced{false};
+  std::string exe{"gnuplot"};
+  std::string filename{};
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--null") == 0) {
+      null_sink = true;
+    } else if (std::strcmp(argv[i], "--paced") == 0) {
+      paced = true;
+    } else if (std::strcmp(argv[i], "--exe") == 0 && i + 1 < argc) {
+      exe = argv[++i];
+    } else if (argv[i][0] != '-' && filename.empty()) {
+      filename = argv[i];
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (filename.empty()) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  GnuplotSessionReader reader{filename};
+  if (!reader.ok()) {
+    std::cerr << "Error, \"" << filename
+              << "\" is not a valid session file\n";
+    return 1;
+  }
+
+  auto backend = make_backend(null_sink, exe);
+  if (!backend->ok()) {
+    std::cerr << "Error, unable to start \"" << exe << "\"\n";
+    return 1;
+  }
+
+  size_t num_of_events{}, num_of_bytes{}, slowest_event{};
+  clock_type::duration slowest{};
+  std::chrono::nanoseconds recorded_duration{};
+  GnuplotSessionEvent event;
+
+  const auto start = clock_type::now();
+  while (reader.next(event)) {
+    if (paced)
+      std::this_thread::sleep_until(start + event.time);
+
+    const auto before = clock_type::now();
+    bool success{true};
+    switch (event.kind) {
+    case GnuplotSessionEvent::Kind::COMMAND:
+      success = backend->write(GnuplotBackend::Channel::COMMAND,
+                               event.bytes.data(), event.bytes.size());
+      break;
+    case GnuplotSessionEvent::Kind::DATA:
+      success = backend->write(GnuplotBackend::Channel::DATA,
+                               event.bytes.data(), event.bytes.size());
+      break;
+    case GnuplotSessionEvent::Kind::FLUSH:
+      success = backend->flush();
+      break;
+    case GnuplotSessionEvent::Kind::SYNC:
+      // Not all the backends support this, so it is not an error
+      backend->sync(-1, nullptr);
+      break;
+    }
+
+    if (!success) {
+      std::cerr << "Error, unable to replay event #" << num_of_events << "\n";
+      return 1;
+    }
+
+    const auto elapsed = clock_type::now() - before;
+    if (elapsed > slowest) {
+      slowest = elapsed;
+      slowest_event = num_of_events;
+    }
+
+    ++num_of_events;
+    num_of_bytes += event.bytes.size();
+    recorded_duration = event.time;
+  }
+
+  if (!reader.ok())
+    std::cerr << "Warning, the session file is truncated\n";
+
+  // Wait until Gnuplot has finished, so that the time is meaningful
+  backend->flush();
+  backend->sync(-1, nullptr);
+  backend->close();
+  const auto total = clock_type::now() - start;
+
+  std::cout << "Events:           " << num_of_events << "\n"
+            << "Bytes:            " << num_of_bytes << "\n"
+            << "Recorded time:    " << seconds(recorded_duration) << " s\n"
+            << "Replay time:      " << seconds(total) << " s\n"
+            << "Slowest event:    #" << slowest_event << " ("
+            << seconds(slowest) << " s)\n";
+
+  return reader.ok() ? 0 : 1;
+}
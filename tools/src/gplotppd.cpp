@@ -0,0 +1,104 @@
+/* Copyright 2020 Maurizio Tomasi
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* gplotppd - Lend Gnuplot processes to other programs
+ *
+ * Usage: gplotppd [--processes N] [--exe GNUPLOT] SOCKET
+ *
+ * Programs connect to SOCKET using `GnuplotDaemonBackend`: their
+ * commands are sent through the socket, and their datablocks through
+ * shared memory. The daemon keeps N Gnuplot processes ready (default:
+ * 2) and quits on SIGINT or SIGTERM.
+ */
+
+#include "gplot++.h"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+int main() {
+  std::cerr << "gplotppd is not available on Windows\n";
+  return 1;
+}
+#else
+static void print_usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--processes N] [--exe GNUPLOT] SOCKET\n";
+}
+
+int main(int argc, char *argv[]) {
+  size_t num_of_processes{2};
+  std::string executable{"gnuplot"};
+  std::string socket_path{};
+
+  for (int i{1}; i < argc; ++i) {
+    const std::string arg{argv[i]};
+    if (arg == "--processes" && i + 1 < argc) {
+      num_of_processes = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--exe" && i + 1 < argc) {
+      executable = argv[++i];
+    } else if (arg == "-h" || arg == "--help") {
+      print_usage(argv[0]);
+      return 0;
+    } else if (socket_path.empty() && arg[0] != '-') {
+      socket_path = arg;
+    } else {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (socket_path.empty()) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  // Block the signals before starting any thread, so that only
+  // `sigwait` below receives them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  GnuplotDaemon daemon{socket_path, num_of_processes, executable.c_str()};
+  if (!daemon.ok()) {
+    std::cerr << "Unable to listen on " << socket_path << "\n";
+    return 1;
+  }
+
+  std::cerr << "Listening on " << socket_path << " with "
+            << num_of_processes << " Gnuplot processes\n";
+  std::thread server{[&daemon]() { daemon.run(); }};
+
+  int signal_number{};
+  sigwait(&signals, &signal_number);
+
+  daemon.stop();
+  server.join();
+  return 0;
+}
+#endif